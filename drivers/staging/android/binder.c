@@ -19,26 +19,56 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/nsproxy.h>
+#include <linux/percpu.h>
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/proc_fs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
+/*
+ * Locking:
+ *
+ * binder_main_lock is taken for reading by binder_ioctl and binder_poll,
+ * and for writing by the events that create or destroy procs and threads
+ * (binder_open, BINDER_THREAD_EXIT, BINDER_SET_CONTEXT_MGR and the deferred
+ * flush/release work) as well as by the debug dumps. Holding it for reading
+ * guarantees that every binder_proc and binder_thread stays allocated.
+ *
+ * proc->lock protects the threads, nodes and refs rbtrees of a proc, the
+ * refs it owns and its buffer allocator. Only the owning proc inserts into
+ * or erases from proc->nodes. A thread normally holds only the lock of its
+ * own proc; binder_transaction additionally takes the lock of the target
+ * proc, always in address order (binder_lock_target).
+ *
+ * proc->inner_lock protects the todo lists of the proc and its threads, the
+ * state of the nodes owned by the proc (reference counts, node->refs,
+ * node->work, async_todo), and the transaction stacks and return errors of
+ * its threads. It nests inside proc->lock and no two inner locks are ever
+ * held at the same time. Nodes of a released proc are protected by
+ * binder_dead_nodes_lock instead.
+ */
+static DECLARE_RWSEM(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -50,7 +80,7 @@ static struct proc_dir_entry *binder_proc_dir_entry_root;
 static struct proc_dir_entry *binder_proc_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_BUG_DEBUG 1	/* This's for debug purpose, remove related codes after solving issue. */
@@ -154,24 +184,47 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
+/*
+ * Transaction latency histograms. Bucket 0 counts latencies below 1us and
+ * bucket n those in [2^(n-1), 2^n) us; the last bucket is open ended.
+ * The system wide histogram is per-CPU so it needs no locking at all. The
+ * per-proc and per-node ones are only updated with the owning proc->lock
+ * held, and per-node ones are allocated on the first transaction to the
+ * node so that plain objects do not pay for them.
+ */
+#define BINDER_LATENCY_BUCKETS	20
+
+enum binder_latency_stage {
+	BINDER_LATENCY_QUEUE,		/* send -> receive */
+	BINDER_LATENCY_SERVICE,		/* receive -> reply */
+	BINDER_LATENCY_ROUND_TRIP,	/* send -> reply */
+	BINDER_LATENCY_COUNT
+};
+
+struct binder_latency {
+	unsigned long hist[BINDER_LATENCY_COUNT][BINDER_LATENCY_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct binder_latency, binder_latency);
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -185,7 +238,7 @@ struct binder_transaction_log_entry {
 	int offsets_size;
 };
 struct binder_transaction_log {
-	int next;
+	atomic_t cur;
 	int full;
 	struct binder_transaction_log_entry entry[32];
 };
@@ -196,16 +249,22 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
-	e = &log->entry[log->next];
-	memset(e, 0, sizeof(*e));
-	log->next++;
-	if (log->next == ARRAY_SIZE(log->entry)) {
-		log->next = 0;
+	unsigned int cur = atomic_inc_return(&log->cur) - 1;
+
+	if (cur >= ARRAY_SIZE(log->entry))
 		log->full = 1;
-	}
+	e = &log->entry[cur % ARRAY_SIZE(log->entry)];
+	memset(e, 0, sizeof(*e));
 	return e;
 }
 
+/* index of the oldest entry once the log has wrapped */
+static inline int binder_transaction_log_next(
+	struct binder_transaction_log *log)
+{
+	return (unsigned int)atomic_read(&log->cur) % ARRAY_SIZE(log->entry);
+}
+
 struct binder_work {
 	struct list_head entry;
 	enum {
@@ -240,6 +299,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_latency *latency;
 };
 
 struct binder_ref_death {
@@ -264,6 +324,33 @@ struct binder_ref {
 	struct binder_ref_death *death;
 };
 
+/*
+ * Transactions of up to BINDER_SIZE_CLASS_MAX bytes are carved from the
+ * mmap'd area in power of two size classes. When such a buffer is freed it
+ * is parked on a per-proc free list for its class instead of being merged
+ * back and having its pages unmapped, so the next allocation of that class
+ * is a list pop with the pages already in place. The lists are bounded by
+ * BINDER_SIZE_CLASS_CACHE_MAX and drained when the best-fit allocator runs
+ * out of address space.
+ */
+#define BINDER_SIZE_CLASS_MIN_SHIFT	5
+#define BINDER_SIZE_CLASS_COUNT		4
+#define BINDER_SIZE_CLASS_MAX \
+	(1U << (BINDER_SIZE_CLASS_MIN_SHIFT + BINDER_SIZE_CLASS_COUNT - 1))
+#define BINDER_SIZE_CLASS_CACHE_MAX	16
+
+struct binder_alloc_stats {
+	atomic_t class_alloc[BINDER_SIZE_CLASS_COUNT];
+	atomic_t class_hit[BINDER_SIZE_CLASS_COUNT];
+	atomic_t large_alloc;
+	atomic_t failed;
+	atomic_t drain;
+	atomic_t pages_mapped;
+	atomic_t pages_unmapped;
+};
+
+static struct binder_alloc_stats binder_alloc_stats;
+
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
 	struct rb_node rb_node; /* free entry by size or allocated entry */
@@ -272,7 +359,10 @@ struct binder_buffer {
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
 	unsigned debug_id:29;
+	unsigned size_class:3; /* size class index + 1, 0 if unclassed */
+	unsigned cached:1; /* parked on a size class free list */
 
+	struct list_head class_entry; /* size class free list entry */
 	struct binder_transaction *transaction;
 
 	struct binder_node *target_node;
@@ -281,6 +371,15 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+/*
+ * Scheduling class of a thread. prio is the nice value for the normal
+ * policies and the rt_priority for SCHED_FIFO and SCHED_RR.
+ */
+struct binder_priority {
+	int sched_policy;
+	long prio;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -289,6 +388,8 @@ enum binder_deferred_state {
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex lock;
+	spinlock_t inner_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -305,6 +406,8 @@ struct binder_proc {
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
+	struct list_head size_class_free[BINDER_SIZE_CLASS_COUNT];
+	int size_class_cached[BINDER_SIZE_CLASS_COUNT];
 	size_t free_async_space;
 
 	struct page **pages;
@@ -318,8 +421,9 @@ struct binder_proc {
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	int oneway_batch;
 	struct dentry *debugfs_entry;
+	struct binder_latency latency;
 };
 
 enum {
@@ -331,6 +435,14 @@ enum {
 	BINDER_LOOPER_STATE_NEED_RETURN = 0x20
 };
 
+/*
+ * Wakeups for one-way transactions to procs that enabled
+ * BINDER_SET_ONEWAY_BATCH are collected while a write buffer is parsed and
+ * issued once per target when it is done, so a burst of one-way calls wakes
+ * one reader per proc instead of one per transaction.
+ */
+#define BINDER_MAX_DEFERRED_WAKEUPS	8
+
 struct binder_thread {
 	struct binder_proc *proc;
 	struct rb_node rb_node;
@@ -344,6 +456,10 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	wait_queue_head_t *deferred_wakeup[BINDER_MAX_DEFERRED_WAKEUPS];
+	int deferred_wakeups;
+	/* the thread's own priority, restored when it waits for work */
+	struct binder_priority base_priority;
 };
 
 struct binder_transaction {
@@ -360,9 +476,11 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
+	ktime_t	recv_time;
 };
 
 static void
@@ -558,6 +676,57 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static int binder_is_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static void binder_get_priority(struct task_struct *task,
+				struct binder_priority *p)
+{
+	p->sched_policy = task->policy;
+	if (binder_is_rt_policy(p->sched_policy))
+		p->prio = task->rt_priority;
+	else
+		p->prio = task_nice(task);
+}
+
+/*
+ * Move current to the policy and priority in @desired. Switching in and
+ * out of the RT classes bypasses the RLIMIT_RTPRIO check on purpose: the
+ * priority is only ever one the calling thread already had.
+ */
+static void binder_set_priority(struct binder_priority *desired)
+{
+	struct sched_param param;
+	int ret;
+
+	if (binder_is_rt_policy(desired->sched_policy)) {
+		if (current->policy == desired->sched_policy &&
+		    current->rt_priority == desired->prio)
+			return;
+		param.sched_priority = desired->prio;
+		ret = sched_setscheduler_nocheck(current,
+						 desired->sched_policy, &param);
+		if (ret)
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: rt priority %d:%ld failed "
+				     "%d\n", current->pid,
+				     desired->sched_policy, desired->prio, ret);
+		return;
+	}
+	if (binder_is_rt_policy(current->policy)) {
+		param.sched_priority = 0;
+		ret = sched_setscheduler_nocheck(current,
+						 desired->sched_policy, &param);
+		if (ret)
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: policy %d failed %d\n",
+				     current->pid, desired->sched_policy, ret);
+	}
+	binder_set_nice(desired->prio);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -721,6 +890,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 			goto err_vm_insert_page_failed;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
+		atomic_inc(&binder_alloc_stats.pages_mapped);
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -732,6 +902,7 @@ free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		atomic_inc(&binder_alloc_stats.pages_unmapped);
 		if (vma)
 			zap_page_range(vma, (uintptr_t)page_addr +
 				proc->user_buffer_offset, PAGE_SIZE, NULL);
@@ -751,40 +922,53 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static int binder_size_class(size_t size)
+{
+	int class = 0;
+
+	if (size > BINDER_SIZE_CLASS_MAX)
+		return -1;
+	while (size > (1U << (BINDER_SIZE_CLASS_MIN_SHIFT + class)))
+		class++;
+	return class;
+}
+
+static size_t binder_size_class_size(int class)
+{
+	return 1U << (BINDER_SIZE_CLASS_MIN_SHIFT + class);
+}
+
+static struct binder_buffer *binder_size_class_get(struct binder_proc *proc,
+						    int class)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
-	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
-	void *has_page_addr;
-	void *end_page_addr;
-	size_t size;
 
-	if (proc->vma == NULL) {
-		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
-		       proc->pid);
+	if (list_empty(&proc->size_class_free[class]))
 		return NULL;
-	}
 
-	size = ALIGN(data_size, sizeof(void *)) +
-		ALIGN(offsets_size, sizeof(void *));
+	buffer = list_first_entry(&proc->size_class_free[class],
+				  struct binder_buffer, class_entry);
+	list_del_init(&buffer->class_entry);
+	proc->size_class_cached[class]--;
+	BUG_ON(!buffer->cached || buffer->free);
+	buffer->cached = 0;
+	binder_insert_allocated_buffer(proc, buffer);
 
-	if (size < data_size || size < offsets_size) {
-		binder_user_error("binder: %d: got transaction with invalid "
-			"size %zd-%zd\n", proc->pid, data_size, offsets_size);
-		return NULL;
-	}
+	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: reuse class %d buffer %p\n",
+		     proc->pid, class, buffer);
+	return buffer;
+}
 
-	if (is_async &&
-	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
-		binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-			     "binder: %d: binder_alloc_buf size %zd"
-			     "failed, no async space left\n", proc->pid, size);
-		return NULL;
-	}
+static struct binder_buffer *binder_alloc_buf_best_fit(struct binder_proc *proc,
+						       size_t size)
+{
+	struct rb_node *n = proc->free_buffers.rb_node;
+	struct binder_buffer *buffer;
+	size_t buffer_size;
+	struct rb_node *best_fit = NULL;
+	void *has_page_addr;
+	void *end_page_addr;
 
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
@@ -804,11 +988,8 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 			break;
 		}
 	}
-	if (best_fit == NULL) {
-		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
-		       "no address space\n", proc->pid, size);
+	if (best_fit == NULL)
 		return NULL;
-	}
 	if (n == NULL) {
 		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
 		buffer_size = binder_buffer_size(proc, buffer);
@@ -841,22 +1022,13 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
 		list_add(&new_buffer->entry, &buffer->entry);
 		new_buffer->free = 1;
+		new_buffer->size_class = 0;
+		new_buffer->cached = 0;
 		binder_insert_free_buffer(proc, new_buffer);
 	}
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got "
 		     "%p\n", proc->pid, size, buffer);
-	buffer->data_size = data_size;
-	buffer->offsets_size = offsets_size;
-	buffer->async_transaction = is_async;
-	if (is_async) {
-		proc->free_async_space -= size + sizeof(struct binder_buffer);
-		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
-			     "binder: %d: binder_alloc_buf size %zd "
-			     "async free %zd\n", proc->pid, size,
-			     proc->free_async_space);
-	}
-
 	return buffer;
 }
 
@@ -917,10 +1089,72 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
+static void binder_release_buf(struct binder_proc *proc,
+			       struct binder_buffer *buffer)
+{
+	size_t buffer_size = binder_buffer_size(proc, buffer);
+
+	binder_update_page_range(proc, 0,
+		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
+		NULL);
+	buffer->free = 1;
+	buffer->size_class = 0;
+	if (!list_is_last(&buffer->entry, &proc->buffers)) {
+		struct binder_buffer *next = list_entry(buffer->entry.next,
+						struct binder_buffer, entry);
+		if (next->free) {
+			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_delete_free_buffer(proc, next);
+		}
+	}
+	if (proc->buffers.next != &buffer->entry) {
+		struct binder_buffer *prev = list_entry(buffer->entry.prev,
+						struct binder_buffer, entry);
+		if (prev->free) {
+			binder_delete_free_buffer(proc, buffer);
+			rb_erase(&prev->rb_node, &proc->free_buffers);
+			buffer = prev;
+		}
+	}
+	binder_insert_free_buffer(proc, buffer);
+}
+
+/*
+ * Give every buffer parked on the size class free lists back to the
+ * best-fit allocator. Returns the number of buffers released.
+ */
+static int binder_size_class_drain(struct binder_proc *proc)
+{
+	struct binder_buffer *buffer, *tmp;
+	int count = 0;
+	int i;
+
+	for (i = 0; i < BINDER_SIZE_CLASS_COUNT; i++) {
+		list_for_each_entry_safe(buffer, tmp,
+					 &proc->size_class_free[i],
+					 class_entry) {
+			list_del_init(&buffer->class_entry);
+			buffer->cached = 0;
+			binder_release_buf(proc, buffer);
+			count++;
+		}
+		proc->size_class_cached[i] = 0;
+	}
+	if (count) {
+		atomic_inc(&binder_alloc_stats.drain);
+		binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+			     "binder: %d: drained %d size class buffers\n",
+			     proc->pid, count);
+	}
+	return count;
+}
+
 static void binder_free_buf(struct binder_proc *proc,
 			    struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
+	int class;
 
 	buffer_size = binder_buffer_size(proc, buffer);
 
@@ -932,6 +1166,7 @@ static void binder_free_buf(struct binder_proc *proc,
 		     "_size %zd\n", proc->pid, buffer, size, buffer_size);
 
 	BUG_ON(buffer->free);
+	BUG_ON(buffer->cached);
 	BUG_ON(size > buffer_size);
 	BUG_ON(buffer->transaction != NULL);
 	BUG_ON((void *)buffer < proc->buffer);
@@ -946,30 +1181,89 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
-	binder_update_page_range(proc, 0,
-		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
-	buffer->free = 1;
-	if (!list_is_last(&buffer->entry, &proc->buffers)) {
-		struct binder_buffer *next = list_entry(buffer->entry.next,
-						struct binder_buffer, entry);
-		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
-			binder_delete_free_buffer(proc, next);
-		}
+
+	class = buffer->size_class - 1;
+	if (class >= 0 && proc->vma &&
+	    proc->size_class_cached[class] < BINDER_SIZE_CLASS_CACHE_MAX) {
+		/* keep it carved out and mapped for the next small buffer */
+		buffer->cached = 1;
+		list_add(&buffer->class_entry, &proc->size_class_free[class]);
+		proc->size_class_cached[class]++;
+		return;
 	}
-	if (proc->buffers.next != &buffer->entry) {
-		struct binder_buffer *prev = list_entry(buffer->entry.prev,
-						struct binder_buffer, entry);
-		if (prev->free) {
-			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
-			buffer = prev;
+	binder_release_buf(proc, buffer);
+}
+
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer = NULL;
+	size_t size;
+	size_t alloc_size;
+	int class;
+
+	if (proc->vma == NULL) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
+		       proc->pid);
+		return NULL;
+	}
+
+	size = ALIGN(data_size, sizeof(void *)) +
+		ALIGN(offsets_size, sizeof(void *));
+
+	if (size < data_size || size < offsets_size) {
+		binder_user_error("binder: %d: got transaction with invalid "
+			"size %zd-%zd\n", proc->pid, data_size, offsets_size);
+		return NULL;
+	}
+
+	if (is_async &&
+	    proc->free_async_space < size + sizeof(struct binder_buffer)) {
+		binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+			     "binder: %d: binder_alloc_buf size %zd"
+			     "failed, no async space left\n", proc->pid, size);
+		return NULL;
+	}
+
+	alloc_size = size;
+	class = binder_size_class(size);
+	if (class >= 0) {
+		atomic_inc(&binder_alloc_stats.class_alloc[class]);
+		buffer = binder_size_class_get(proc, class);
+		if (buffer)
+			atomic_inc(&binder_alloc_stats.class_hit[class]);
+		else
+			alloc_size = binder_size_class_size(class);
+	} else
+		atomic_inc(&binder_alloc_stats.large_alloc);
+
+	if (buffer == NULL) {
+		buffer = binder_alloc_buf_best_fit(proc, alloc_size);
+		if (buffer == NULL && binder_size_class_drain(proc))
+			buffer = binder_alloc_buf_best_fit(proc, alloc_size);
+		if (buffer == NULL) {
+			atomic_inc(&binder_alloc_stats.failed);
+			printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd "
+			       "failed, no address space\n", proc->pid, size);
+			return NULL;
 		}
+		buffer->size_class = class + 1;
 	}
-	binder_insert_free_buffer(proc, buffer);
+
+	buffer->data_size = data_size;
+	buffer->offsets_size = offsets_size;
+	buffer->async_transaction = is_async;
+	if (is_async) {
+		proc->free_async_space -= size + sizeof(struct binder_buffer);
+		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
+			     "binder: %d: binder_alloc_buf size %zd "
+			     "async free %zd\n", proc->pid, size,
+			     proc->free_async_space);
+	}
+
+	return buffer;
 }
 
 static struct binder_node *binder_get_node(struct binder_proc *proc,
@@ -1017,7 +1311,7 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
@@ -1031,9 +1325,32 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
+static spinlock_t *binder_node_inner_lock(struct binder_node *node)
+{
+	/* node->proc only changes under binder_main_lock held for writing */
+	return node->proc ? &node->proc->inner_lock : &binder_dead_nodes_lock;
+}
+
+/*
+ * The node's work, if it has to be queued, goes on target_thread's todo
+ * list. That thread must belong to the node's proc, so that the proc's
+ * inner lock covers both the node and the list.
+ */
 static int binder_inc_node(struct binder_node *node, int strong, int internal,
-			   struct list_head *target_list)
+			   struct binder_thread *target_thread)
 {
+	spinlock_t *lock = binder_node_inner_lock(node);
+	struct list_head *target_list = NULL;
+	int ret = 0;
+
+	if (target_thread) {
+		if (WARN_ON(target_thread->proc != node->proc))
+			return -EINVAL;
+		lock = &target_thread->proc->inner_lock;
+		target_list = &target_thread->todo;
+	}
+
+	spin_lock(lock);
 	if (strong) {
 		if (internal) {
 			if (target_list == NULL &&
@@ -1042,7 +1359,8 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			    node->has_strong_ref)) {
 				printk(KERN_ERR "binder: invalid inc strong "
 					"node for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			node->internal_strong_refs++;
 		} else
@@ -1058,28 +1376,35 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			if (target_list == NULL) {
 				printk(KERN_ERR "binder: invalid inc weak node "
 					"for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			list_add_tail(&node->work.entry, target_list);
 		}
 	}
-	return 0;
+out:
+	spin_unlock(lock);
+	return ret;
 }
 
 static int binder_dec_node(struct binder_node *node, int strong, int internal)
 {
+	spinlock_t *lock = binder_node_inner_lock(node);
+	int free_node = 0;
+
+	spin_lock(lock);
 	if (strong) {
 		if (internal)
 			node->internal_strong_refs--;
 		else
 			node->local_strong_refs--;
 		if (node->local_strong_refs || node->internal_strong_refs)
-			return 0;
+			goto out;
 	} else {
 		if (!internal)
 			node->local_weak_refs--;
 		if (node->local_weak_refs || !hlist_empty(&node->refs))
-			return 0;
+			goto out;
 	}
 	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
 		if (list_empty(&node->work.entry)) {
@@ -1089,27 +1414,35 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
 		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
 			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
+				/*
+				 * Only the owner may erase from proc->nodes,
+				 * so queue the node and let the owner's
+				 * binder_thread_read delete it.
+				 */
+				if (list_empty(&node->work.entry))
+					list_add_tail(&node->work.entry,
+						      &node->proc->todo);
 			} else {
+				list_del_init(&node->work.entry);
 				hlist_del(&node->dead_node);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: dead node %d deleted\n",
-					     node->debug_id);
+				free_node = 1;
 			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
 		}
 	}
+out:
+	spin_unlock(lock);
 
+	if (free_node) {
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: dead node %d deleted\n",
+			     node->debug_id);
+		kfree(node);
+		binder_stats_deleted(BINDER_STAT_NODE);
+	}
 	return 0;
 }
 
-
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
 {
@@ -1152,7 +1485,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1181,7 +1514,11 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		spinlock_t *lock = binder_node_inner_lock(node);
+
+		spin_lock(lock);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		spin_unlock(lock);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1198,6 +1535,8 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	spinlock_t *lock;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
@@ -1207,14 +1546,19 @@ static void binder_delete_ref(struct binder_ref *ref)
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
 	if (ref->strong)
 		binder_dec_node(ref->node, 1, 1);
+	lock = binder_node_inner_lock(ref->node);
+	spin_lock(lock);
 	hlist_del(&ref->node_entry);
+	spin_unlock(lock);
 	binder_dec_node(ref->node, 0, 1);
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		spin_lock(&ref->proc->inner_lock);
 		list_del(&ref->death->work.entry);
+		spin_unlock(&ref->proc->inner_lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1223,19 +1567,19 @@ static void binder_delete_ref(struct binder_ref *ref)
 }
 
 static int binder_inc_ref(struct binder_ref *ref, int strong,
-			  struct list_head *target_list)
+			  struct binder_thread *target_thread)
 {
 	int ret;
 	if (strong) {
 		if (ref->strong == 0) {
-			ret = binder_inc_node(ref->node, 1, 1, target_list);
+			ret = binder_inc_node(ref->node, 1, 1, target_thread);
 			if (ret)
 				return ret;
 		}
 		ref->strong++;
 	} else {
 		if (ref->weak == 0) {
-			ret = binder_inc_node(ref->node, 0, 1, target_list);
+			ret = binder_inc_node(ref->node, 0, 1, target_thread);
 			if (ret)
 				return ret;
 		}
@@ -1277,6 +1621,10 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
+/*
+ * Caller must hold target_thread->proc->inner_lock when target_thread is
+ * set, and the lock of the proc owning t->buffer.
+ */
 static void binder_pop_transaction(struct binder_thread *target_thread,
 				   struct binder_transaction *t)
 {
@@ -1302,6 +1650,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	while (1) {
 		target_thread = t->from;
 		if (target_thread) {
+			spin_lock(&target_thread->proc->inner_lock);
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
 				target_thread->return_error2 =
@@ -1325,6 +1674,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 					target_thread->pid,
 					target_thread->return_error);
 			}
+			spin_unlock(&target_thread->proc->inner_lock);
 			return;
 		} else {
 			struct binder_transaction *next = t->from_parent;
@@ -1424,6 +1774,124 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+static int binder_latency_bucket(s64 us)
+{
+	int bucket;
+
+	if (us <= 0)
+		return 0;
+	bucket = fls64(us);
+	if (bucket >= BINDER_LATENCY_BUCKETS)
+		bucket = BINDER_LATENCY_BUCKETS - 1;
+	return bucket;
+}
+
+/*
+ * Account one latency sample. The caller holds proc->lock, and @node, if
+ * not NULL, belongs to @proc.
+ */
+static void binder_latency_add(struct binder_proc *proc,
+			       struct binder_node *node,
+			       enum binder_latency_stage stage, s64 us)
+{
+	int bucket = binder_latency_bucket(us);
+
+	this_cpu_inc(binder_latency.hist[stage][bucket]);
+	proc->latency.hist[stage][bucket]++;
+	if (node == NULL)
+		return;
+	if (node->latency == NULL) {
+		node->latency = kzalloc(sizeof(*node->latency), GFP_KERNEL);
+		if (node->latency == NULL)
+			return;
+	}
+	node->latency->hist[stage][bucket]++;
+}
+
+static void binder_latency_received(struct binder_proc *proc,
+				    struct binder_transaction *t)
+{
+	struct binder_node *node = t->buffer->target_node;
+	s64 queue_us;
+
+	t->recv_time = ktime_get();
+	queue_us = ktime_us_delta(t->recv_time, t->start_time);
+	binder_latency_add(proc, node, BINDER_LATENCY_QUEUE, queue_us);
+	trace_binder_transaction_received(t->debug_id,
+					  node ? node->debug_id : 0,
+					  proc->pid, queue_us);
+}
+
+static void binder_latency_replied(struct binder_proc *proc,
+				   struct binder_transaction *in_reply_to,
+				   struct binder_transaction *reply)
+{
+	struct binder_node *node = NULL;
+	s64 service_us, round_trip_us;
+
+	/* the buffer, unless already freed, pins a node of this proc */
+	if (in_reply_to->buffer)
+		node = in_reply_to->buffer->target_node;
+	service_us = ktime_us_delta(reply->start_time,
+				    in_reply_to->recv_time);
+	round_trip_us = ktime_us_delta(reply->start_time,
+				       in_reply_to->start_time);
+	binder_latency_add(proc, node, BINDER_LATENCY_SERVICE, service_us);
+	binder_latency_add(proc, node, BINDER_LATENCY_ROUND_TRIP,
+			   round_trip_us);
+	trace_binder_transaction_reply(in_reply_to->debug_id,
+				       node ? node->debug_id : 0,
+				       proc->pid, service_us, round_trip_us);
+}
+
+static void binder_flush_wakeups(struct binder_thread *thread)
+{
+	int i;
+
+	for (i = 0; i < thread->deferred_wakeups; i++)
+		wake_up_interruptible(thread->deferred_wakeup[i]);
+	thread->deferred_wakeups = 0;
+}
+
+static void binder_defer_wakeup(struct binder_thread *thread,
+				wait_queue_head_t *wait)
+{
+	int i;
+
+	for (i = 0; i < thread->deferred_wakeups; i++)
+		if (thread->deferred_wakeup[i] == wait)
+			return;
+	if (thread->deferred_wakeups == BINDER_MAX_DEFERRED_WAKEUPS)
+		binder_flush_wakeups(thread);
+	thread->deferred_wakeup[thread->deferred_wakeups++] = wait;
+}
+
+/*
+ * Take the lock of @target in addition to the lock of @proc held by the
+ * caller. The two are always nested in address order, so @proc->lock may be
+ * dropped and retaken here.
+ */
+static void binder_lock_target(struct binder_proc *proc,
+			       struct binder_proc *target)
+{
+	if (target == proc)
+		return;
+	if (target > proc) {
+		mutex_lock_nested(&target->lock, SINGLE_DEPTH_NESTING);
+	} else {
+		mutex_unlock(&proc->lock);
+		mutex_lock(&target->lock);
+		mutex_lock_nested(&proc->lock, SINGLE_DEPTH_NESTING);
+	}
+}
+
+static void binder_unlock_target(struct binder_proc *proc,
+				 struct binder_proc *target)
+{
+	if (target != proc)
+		mutex_unlock(&target->lock);
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1449,7 +1917,13 @@ static void binder_transaction(struct binder_proc *proc,
 	e->offsets_size = tr->offsets_size;
 
 	if (reply) {
+		struct binder_transaction *target_stack;
+
+		spin_lock(&proc->inner_lock);
 		in_reply_to = thread->transaction_stack;
+		if (in_reply_to && in_reply_to->to_thread == thread)
+			thread->transaction_stack = in_reply_to->to_parent;
+		spin_unlock(&proc->inner_lock);
 		if (in_reply_to == NULL) {
 			binder_user_error("binder: %d:%d got reply transaction "
 					  "with no transaction stack\n",
@@ -1457,7 +1931,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_set_priority(&in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1471,19 +1945,19 @@ static void binder_transaction(struct binder_proc *proc,
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
-		thread->transaction_stack = in_reply_to->to_parent;
 		target_thread = in_reply_to->from;
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
-		if (target_thread->transaction_stack != in_reply_to) {
+		spin_lock(&target_thread->proc->inner_lock);
+		target_stack = target_thread->transaction_stack;
+		spin_unlock(&target_thread->proc->inner_lock);
+		if (target_stack != in_reply_to) {
 			binder_user_error("binder: %d:%d got reply transaction "
-				"with bad target transaction stack %d, "
+				"with bad target transaction stack, "
 				"expected %d\n",
 				proc->pid, thread->pid,
-				target_thread->transaction_stack ?
-				target_thread->transaction_stack->debug_id : 0,
 				in_reply_to->debug_id);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
@@ -1516,10 +1990,12 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		spin_lock(&proc->inner_lock);
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
 			tmp = thread->transaction_stack;
 			if (tmp->to_thread != thread) {
+				spin_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d got new "
 					"transaction with bad transaction stack"
 					", transaction %d has target %d:%d\n",
@@ -1536,7 +2012,14 @@ static void binder_transaction(struct binder_proc *proc,
 				tmp = tmp->from_parent;
 			}
 		}
+		spin_unlock(&proc->inner_lock);
+		/*
+		 * Pin the target node before proc->lock can be dropped by
+		 * binder_lock_target; the buffer takes over this reference.
+		 */
+		binder_inc_node(target_node, 1, 0, NULL);
 	}
+	binder_lock_target(proc, target_proc);
 	if (target_thread) {
 		e->to_thread = target_thread->pid;
 		target_list = &target_thread->todo;
@@ -1562,7 +2045,8 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
+	t->start_time = ktime_get();
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1591,7 +2075,7 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	binder_get_priority(current, &t->priority);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
@@ -1602,8 +2086,6 @@ static void binder_transaction(struct binder_proc *proc,
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
@@ -1673,7 +2155,7 @@ static void binder_transaction(struct binder_proc *proc,
 				fp->type = BINDER_TYPE_WEAK_HANDLE;
 			fp->handle = ref->desc;
 			binder_inc_ref(ref, fp->type == BINDER_TYPE_HANDLE,
-				       &thread->todo);
+				       thread);
 
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        node %d u%p -> ref %d desc %d\n",
@@ -1765,15 +2247,35 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
-	if (reply) {
-		BUG_ON(t->buffer->async_transaction != 0);
-		binder_pop_transaction(target_thread, in_reply_to);
-	} else if (!(t->flags & TF_ONE_WAY)) {
+	if (reply)
+		binder_latency_replied(proc, in_reply_to, t);
+	trace_binder_transaction(t->debug_id, reply,
+				 target_node ? target_node->debug_id : 0,
+				 target_proc->pid,
+				 target_thread ? target_thread->pid : 0,
+				 t->code, t->flags);
+
+	/*
+	 * Push the transaction and queue the completion on the sending
+	 * thread before the target can see (and reply to) it.
+	 */
+	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	spin_lock(&proc->inner_lock);
+	if (!reply && !(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
 		t->need_reply = 1;
 		t->from_parent = thread->transaction_stack;
 		thread->transaction_stack = t;
-	} else {
+	}
+	list_add_tail(&tcomplete->entry, &thread->todo);
+	spin_unlock(&proc->inner_lock);
+
+	t->work.type = BINDER_WORK_TRANSACTION;
+	spin_lock(&target_proc->inner_lock);
+	if (reply) {
+		BUG_ON(t->buffer->async_transaction != 0);
+		binder_pop_transaction(target_thread, in_reply_to);
+	} else if (t->flags & TF_ONE_WAY) {
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
 		if (target_node->has_async_transaction) {
@@ -1781,13 +2283,16 @@ static void binder_transaction(struct binder_proc *proc,
 			target_wait = NULL;
 		} else
 			target_node->has_async_transaction = 1;
+		if (target_wait && target_proc->oneway_batch) {
+			binder_defer_wakeup(thread, target_wait);
+			target_wait = NULL;
+		}
 	}
-	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
-	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	spin_unlock(&target_proc->inner_lock);
+	binder_unlock_target(proc, target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1802,6 +2307,7 @@ err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
+	target_node = NULL; /* reference dropped with the buffer */
 err_binder_alloc_buf_failed:
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
@@ -1809,6 +2315,9 @@ err_alloc_tcomplete_failed:
 	kfree(t);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 err_alloc_t_failed:
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
+	binder_unlock_target(proc, target_proc);
 err_bad_call_stack:
 err_empty_call_stack:
 err_dead_binder:
@@ -1825,12 +2334,15 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
+	spin_lock(&proc->inner_lock);
 	BUG_ON(thread->return_error != BR_OK);
-	if (in_reply_to) {
+	if (in_reply_to)
 		thread->return_error = BR_TRANSACTION_COMPLETE;
-		binder_send_failed_reply(in_reply_to, return_error);
-	} else
+	else
 		thread->return_error = return_error;
+	spin_unlock(&proc->inner_lock);
+	if (in_reply_to)
+		binder_send_failed_reply(in_reply_to, return_error);
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1845,9 +2357,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1939,8 +2451,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					cookie, node->cookie);
 				break;
 			}
+			spin_lock(&proc->inner_lock);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
+					spin_unlock(&proc->inner_lock);
 					binder_user_error("binder: %d:%d "
 						"BC_ACQUIRE_DONE node %d has "
 						"no pending acquire request\n",
@@ -1951,6 +2465,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				node->pending_strong_ref = 0;
 			} else {
 				if (node->pending_weak_ref == 0) {
+					spin_unlock(&proc->inner_lock);
 					binder_user_error("binder: %d:%d "
 						"BC_INCREFS_DONE node %d has "
 						"no pending increfs request\n",
@@ -1960,6 +2475,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				node->pending_weak_ref = 0;
 			}
+			spin_unlock(&proc->inner_lock);
 			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
@@ -2007,11 +2523,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				buffer->transaction = NULL;
 			}
 			if (buffer->async_transaction && buffer->target_node) {
+				spin_lock(&proc->inner_lock);
 				BUG_ON(!buffer->target_node->has_async_transaction);
 				if (list_empty(&buffer->target_node->async_todo))
 					buffer->target_node->has_async_transaction = 0;
 				else
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+				spin_unlock(&proc->inner_lock);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -2129,12 +2647,14 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				ref->death = death;
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					spin_lock(&proc->inner_lock);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					spin_unlock(&proc->inner_lock);
 				}
 			} else {
 				if (ref->death == NULL) {
@@ -2157,6 +2677,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2169,6 +2690,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->inner_lock);
 			}
 		} break;
 		case BC_DEAD_BINDER_DONE: {
@@ -2196,6 +2718,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				break;
 			}
 
+			spin_lock(&proc->inner_lock);
 			list_del_init(&death->work.entry);
 			if (death->work.type == BINDER_WORK_DEAD_BINDER_AND_CLEAR) {
 				death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
@@ -2206,6 +2729,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->inner_lock);
 		} break;
 
 		default:
@@ -2222,10 +2746,38 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
+	}
+}
+
+/*
+ * Run a synchronous transaction at the caller's priority, including its RT
+ * policy, so that an RT caller is not held up behind a normal service
+ * thread. Normal callers are still raised to at least the node's
+ * min_priority. This only ever boosts: a thread already running at a
+ * higher priority, RT or not, keeps it. The previous priority is restored
+ * on BC_REPLY.
+ */
+static void binder_inherit_priority(struct binder_transaction *t,
+				    struct binder_node *node)
+{
+	struct binder_priority desired = t->priority;
+
+	if (binder_is_rt_policy(desired.sched_policy)) {
+		if (binder_is_rt_policy(current->policy) &&
+		    current->rt_priority >= desired.prio)
+			return;
+	} else {
+		if (binder_is_rt_policy(current->policy))
+			return;
+		if (desired.prio >= node->min_priority)
+			desired.prio = node->min_priority;
+		if (task_nice(current) <= desired.prio)
+			return;
 	}
+	binder_set_priority(&desired);
 }
 
 static int binder_has_proc_work(struct binder_proc *proc,
@@ -2251,6 +2803,8 @@ static int binder_thread_read(struct binder_proc *proc,
 
 	int ret = 0;
 	int wait_for_proc_work;
+	int has_error = 0;
+	uint32_t return_error, return_error2;
 
 	if (*consumed == 0) {
 		if (put_user(BR_NOOP, (uint32_t __user *)ptr))
@@ -2259,22 +2813,32 @@ static int binder_thread_read(struct binder_proc *proc,
 	}
 
 retry:
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 				list_empty(&thread->todo);
-
 	if (thread->return_error != BR_OK && ptr < end) {
-		if (thread->return_error2 != BR_OK) {
-			if (put_user(thread->return_error2, (uint32_t __user *)ptr))
+		has_error = 1;
+		return_error = thread->return_error;
+		return_error2 = thread->return_error2;
+		/* other procs may set these, so consume them under the lock */
+		if (return_error2 == BR_OK || ptr + sizeof(uint32_t) != end) {
+			thread->return_error2 = BR_OK;
+			thread->return_error = BR_OK;
+		}
+	}
+	spin_unlock(&proc->inner_lock);
+
+	if (has_error) {
+		if (return_error2 != BR_OK) {
+			if (put_user(return_error2, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
 			if (ptr == end)
 				goto done;
-			thread->return_error2 = BR_OK;
 		}
-		if (put_user(thread->return_error, (uint32_t __user *)ptr))
+		if (put_user(return_error, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
-		thread->return_error = BR_OK;
 		goto done;
 	}
 
@@ -2282,7 +2846,8 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_main_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2293,7 +2858,7 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_set_priority(&thread->base_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2306,7 +2871,8 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
+	mutex_lock(&proc->lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2320,11 +2886,19 @@ retry:
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
 
+		/*
+		 * Other procs only ever add to these lists, so the entry
+		 * stays at the head while we hold proc->lock.
+		 */
+		spin_lock(&proc->inner_lock);
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
 			w = list_first_entry(&proc->todo, struct binder_work, entry);
-		else {
+		else
+			w = NULL;
+		spin_unlock(&proc->inner_lock);
+		if (w == NULL) {
 			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
@@ -2348,7 +2922,9 @@ retry:
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
 
+			spin_lock(&proc->inner_lock);
 			list_del(&w->entry);
+			spin_unlock(&proc->inner_lock);
 			kfree(w);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
@@ -2356,8 +2932,11 @@ retry:
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
-			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			int strong, weak;
+
+			spin_lock(&proc->inner_lock);
+			strong = node->internal_strong_refs || node->local_strong_refs;
+			weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2379,6 +2958,12 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			if (cmd == BR_NOOP) {
+				list_del_init(&w->entry);
+				if (!weak && !strong)
+					rb_erase(&node->rb_node, &proc->nodes);
+			}
+			spin_unlock(&proc->inner_lock);
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
@@ -2395,13 +2980,12 @@ retry:
 					     "binder: %d:%d %s %d u%p c%p\n",
 					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
 			} else {
-				list_del_init(&w->entry);
 				if (!weak && !strong) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
-					rb_erase(&node->rb_node, &proc->nodes);
+					kfree(node->latency);
 					kfree(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
@@ -2437,12 +3021,16 @@ retry:
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
 				      death->cookie);
 
+			spin_lock(&proc->inner_lock);
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
 				list_del(&w->entry);
+				spin_unlock(&proc->inner_lock);
 				kfree(death);
 				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
+			} else {
 				list_move(&w->entry, &proc->delivered_death);
+				spin_unlock(&proc->inner_lock);
+			}
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
@@ -2456,12 +3044,11 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
+			binder_get_priority(current, &t->saved_priority);
+			if (!(t->flags & TF_ONE_WAY))
+				binder_inherit_priority(t, target_node);
+			else if (!binder_is_rt_policy(current->policy) &&
+				 task_nice(current) > target_node->min_priority)
 				binder_set_nice(target_node->min_priority);
 			cmd = BR_TRANSACTION;
 		} else {
@@ -2497,6 +3084,7 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		binder_latency_received(proc, t);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2508,16 +3096,22 @@ retry:
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
-		list_del(&t->work.entry);
 		t->buffer->allow_user_free = 1;
+		spin_lock(&proc->inner_lock);
+		list_del(&t->work.entry);
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
 			thread->transaction_stack = t;
+			spin_unlock(&proc->inner_lock);
 		} else {
+			spin_unlock(&proc->inner_lock);
 			t->buffer->transaction = NULL;
 			kfree(t);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION);
+			/* batching procs take all queued one-way work at once */
+			if (cmd == BR_TRANSACTION && proc->oneway_batch)
+				continue;
 		}
 		break;
 	}
@@ -2596,6 +3190,7 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
 		thread->return_error = BR_OK;
 		thread->return_error2 = BR_OK;
+		binder_get_priority(current, &thread->base_priority);
 	}
 	return thread;
 }
@@ -2648,13 +3243,17 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work = 0;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
 	if (thread != NULL) {
+		spin_lock(&proc->inner_lock);
 		wait_for_proc_work = thread->transaction_stack == NULL &&
 			list_empty(&thread->todo) && thread->return_error == BR_OK;
+		spin_unlock(&proc->inner_lock);
 	}
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_main_lock);
 
 	if (!thread)
 		return 0;
@@ -2682,6 +3281,9 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	/* these change proc and thread lifetimes seen by other procs */
+	int exclusive = (cmd == BINDER_THREAD_EXIT ||
+			 cmd == BINDER_SET_CONTEXT_MGR);
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
@@ -2689,7 +3291,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	if (exclusive)
+		down_write(&binder_main_lock);
+	else
+		down_read(&binder_main_lock);
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2714,6 +3320,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		if (bwr.write_size > 0) {
 			ret = binder_thread_write(proc, thread, (void __user *)bwr.write_buffer, bwr.write_size, &bwr.write_consumed);
+			binder_flush_wakeups(thread);
 			if (ret < 0) {
 				bwr.read_consumed = 0;
 				if (copy_to_user(ubuf, &bwr, sizeof(bwr)))
@@ -2747,6 +3354,12 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			goto err;
 		}
 		break;
+	case BINDER_SET_ONEWAY_BATCH:
+		if (copy_from_user(&proc->oneway_batch, ubuf, sizeof(proc->oneway_batch))) {
+			ret = -EINVAL;
+			goto err;
+		}
+		break;
 	case BINDER_SET_CONTEXT_MGR:
 		if (binder_context_mgr_node != NULL) {
 			printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
@@ -2798,7 +3411,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	if (exclusive)
+		up_write(&binder_main_lock);
+	else
+		up_read(&binder_main_lock);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2953,6 +3570,7 @@ static int exist_proc_entry(const char *name, struct proc_dir_entry *parent)
 static int binder_open(struct inode *nodp, struct file *filp)
 {
 	struct binder_proc *proc;
+	int i;
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE, "binder_open: %d:%d\n",
 		     current->group_leader->pid, current->pid);
@@ -2962,16 +3580,19 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	mutex_init(&proc->lock);
+	spin_lock_init(&proc->inner_lock);
 	INIT_LIST_HEAD(&proc->todo);
+	for (i = 0; i < BINDER_SIZE_CLASS_COUNT; i++)
+		INIT_LIST_HEAD(&proc->size_class_free[i]);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	down_write(&binder_main_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	up_write(&binder_main_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -3069,6 +3690,8 @@ static void binder_deferred_release(struct binder_proc *proc)
 		nodes++;
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
+		kfree(node->latency);
+		node->latency = NULL;
 		if (hlist_empty(&node->refs)) {
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
@@ -3079,7 +3702,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 			node->proc = NULL;
 			node->local_strong_refs = 0;
 			node->local_weak_refs = 0;
+			spin_lock(&binder_dead_nodes_lock);
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
+			spin_unlock(&binder_dead_nodes_lock);
 
 			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
 				incoming_refs++;
@@ -3124,6 +3749,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_free_buf(proc, buffer);
 		buffers++;
 	}
+	binder_size_class_drain(proc);
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
@@ -3167,7 +3793,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3194,7 +3820,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3218,13 +3844,14 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %d:%ld r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   t->priority.prio, t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3393,13 +4020,14 @@ static char *procfs_print_binder_transaction(char *buf, char *end, const char *p
 {
 	buf += snprintf(buf, end - buf,
 			"%s %d: %p from %d:%d to %d:%d code %x "
-			"flags %x pri %ld r%d",
+			"flags %x pri %d:%ld r%d",
 			prefix, t->debug_id, t,
 			t->from ? t->from->proc->pid : 0,
 			t->from ? t->from->pid : 0,
 			t->to_proc ? t->to_proc->pid : 0,
 			t->to_thread ? t->to_thread->pid : 0,
-			t->code, t->flags, t->priority, t->need_reply);
+			t->code, t->flags, t->priority.sched_policy,
+			t->priority.prio, t->need_reply);
 	if (buf >= end)
 		return buf;
 	if (t->buffer == NULL) {
@@ -3676,17 +4304,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3694,11 +4326,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3764,7 +4398,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3776,7 +4410,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3787,7 +4421,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3796,7 +4430,120 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
+	return 0;
+}
+
+static int binder_alloc_stats_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int do_lock = !binder_debug_no_lock;
+	int i;
+
+	if (do_lock)
+		down_write(&binder_main_lock);
+
+	seq_puts(m, "binder alloc stats:\n");
+	for (i = 0; i < BINDER_SIZE_CLASS_COUNT; i++)
+		seq_printf(m, "class %zd: alloc %d hit %d\n",
+			   binder_size_class_size(i),
+			   atomic_read(&binder_alloc_stats.class_alloc[i]),
+			   atomic_read(&binder_alloc_stats.class_hit[i]));
+	seq_printf(m, "large: %d\n"
+		   "failed: %d\n"
+		   "drain: %d\n"
+		   "pages mapped: %d unmapped: %d\n",
+		   atomic_read(&binder_alloc_stats.large_alloc),
+		   atomic_read(&binder_alloc_stats.failed),
+		   atomic_read(&binder_alloc_stats.drain),
+		   atomic_read(&binder_alloc_stats.pages_mapped),
+		   atomic_read(&binder_alloc_stats.pages_unmapped));
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d: cached", proc->pid);
+		for (i = 0; i < BINDER_SIZE_CLASS_COUNT; i++)
+			seq_printf(m, " %d", proc->size_class_cached[i]);
+		seq_puts(m, "\n");
+	}
+	if (do_lock)
+		up_write(&binder_main_lock);
+	return 0;
+}
+
+static const char *binder_latency_strings[] = {
+	"queue",
+	"service",
+	"round trip"
+};
+
+static void print_binder_latency(struct seq_file *m, const char *prefix,
+				 struct binder_latency *latency)
+{
+	int i, j;
+
+	BUILD_BUG_ON(ARRAY_SIZE(binder_latency_strings) !=
+			BINDER_LATENCY_COUNT);
+	for (i = 0; i < BINDER_LATENCY_COUNT; i++) {
+		unsigned long total = 0;
+
+		for (j = 0; j < BINDER_LATENCY_BUCKETS; j++)
+			total += latency->hist[i][j];
+		if (!total)
+			continue;
+		seq_printf(m, "%s%s: %lu:", prefix, binder_latency_strings[i],
+			   total);
+		for (j = 0; j < BINDER_LATENCY_BUCKETS; j++)
+			seq_printf(m, " %lu", latency->hist[i][j]);
+		seq_puts(m, "\n");
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_latency *total;
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+	int cpu, i, j;
+
+	total = kzalloc(sizeof(*total), GFP_KERNEL);
+	if (total == NULL)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		struct binder_latency *latency = &per_cpu(binder_latency, cpu);
+
+		for (i = 0; i < BINDER_LATENCY_COUNT; i++)
+			for (j = 0; j < BINDER_LATENCY_BUCKETS; j++)
+				total->hist[i][j] += latency->hist[i][j];
+	}
+
+	if (do_lock)
+		down_write(&binder_main_lock);
+
+	seq_printf(m, "binder latency (count: <1us <2us ... <%dus >=%dus):\n",
+		   1 << (BINDER_LATENCY_BUCKETS - 2),
+		   1 << (BINDER_LATENCY_BUCKETS - 2));
+	print_binder_latency(m, "", total);
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency(m, "  ", &proc->latency);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+					struct binder_node, rb_node);
+
+			if (node->latency == NULL)
+				continue;
+			seq_printf(m, "  node %d: u%p c%p\n", node->debug_id,
+				   node->ptr, node->cookie);
+			print_binder_latency(m, "    ", node->latency);
+		}
+	}
+	if (do_lock)
+		up_write(&binder_main_lock);
+	kfree(total);
 	return 0;
 }
 
@@ -3807,13 +4554,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3823,11 +4570,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3845,13 +4592,14 @@ static void print_binder_transaction_log_entry(struct seq_file *m,
 static int binder_transaction_log_show(struct seq_file *m, void *unused)
 {
 	struct binder_transaction_log *log = m->private;
+	int next = binder_transaction_log_next(log);
 	int i;
 
 	if (log->full) {
-		for (i = log->next; i < ARRAY_SIZE(log->entry); i++)
+		for (i = next; i < ARRAY_SIZE(log->entry); i++)
 			print_binder_transaction_log_entry(m, &log->entry[i]);
 	}
-	for (i = 0; i < log->next; i++)
+	for (i = 0; i < next; i++)
 		print_binder_transaction_log_entry(m, &log->entry[i]);
 	return 0;
 }
@@ -3864,10 +4612,11 @@ static char *procfs_print_binder_stats(char *buf, char *end, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 			ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			buf += snprintf(buf, end - buf, "%s%s: %d\n", prefix,
-					binder_command_strings[i],
-					stats->bc[i]);
+					binder_command_strings[i], temp);
 		if (buf >= end)
 			return buf;
 	}
@@ -3875,9 +4624,11 @@ static char *procfs_print_binder_stats(char *buf, char *end, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 			ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			buf += snprintf(buf, end - buf, "%s%s: %d\n", prefix,
-					binder_return_strings[i], stats->br[i]);
+					binder_return_strings[i], temp);
 		if (buf >= end)
 			return buf;
 	}
@@ -3887,13 +4638,14 @@ static char *procfs_print_binder_stats(char *buf, char *end, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 			ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			buf += snprintf(buf, end - buf,
 					"%s%s: active %d total %d\n", prefix,
 					binder_objstat_strings[i],
-					stats->obj_created[i] -
-						stats->obj_deleted[i],
-					stats->obj_created[i]);
+					created - deleted, created);
 		if (buf >= end)
 			return buf;
 	}
@@ -3986,7 +4738,7 @@ static int procfs_binder_read_proc_state(char *page, char **start, off_t off,
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	buf += snprintf(buf, end - buf, "binder state:\n");
 
@@ -4004,7 +4756,7 @@ static int procfs_binder_read_proc_state(char *page, char **start, off_t off,
 		buf = procfs_print_binder_proc(buf, end, proc, 1);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	if (buf > page + PAGE_SIZE)
 		buf = page + PAGE_SIZE;
 
@@ -4032,7 +4784,7 @@ static int procfs_binder_read_proc_stats(char *page, char **start, off_t off,
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	p += snprintf(p, PAGE_SIZE, "binder stats:\n");
 
@@ -4044,7 +4796,7 @@ static int procfs_binder_read_proc_stats(char *page, char **start, off_t off,
 		p = procfs_print_binder_proc_stats(p, page + PAGE_SIZE, proc);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	if (p > page + PAGE_SIZE)
 		p = page + PAGE_SIZE;
 
@@ -4059,6 +4811,65 @@ static int procfs_binder_read_proc_stats(char *page, char **start, off_t off,
 	return len < count ? len  : count;
 }
 
+static int procfs_binder_read_proc_alloc_stats(char *page, char **start,
+				off_t off, int count, int *eof, void *data)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int len = 0;
+	char *p = page;
+	char *end = page + PAGE_SIZE;
+	int do_lock = !binder_debug_no_lock;
+	int i;
+
+	if (off)
+		return 0;
+
+	if (do_lock)
+		down_write(&binder_main_lock);
+
+	p += snprintf(p, end - p, "binder alloc stats:\n");
+	for (i = 0; i < BINDER_SIZE_CLASS_COUNT; i++)
+		p += snprintf(p, end - p, "class %zd: alloc %d hit %d\n",
+			      binder_size_class_size(i),
+			      atomic_read(&binder_alloc_stats.class_alloc[i]),
+			      atomic_read(&binder_alloc_stats.class_hit[i]));
+	p += snprintf(p, end - p, "large: %d\n"
+		      "failed: %d\n"
+		      "drain: %d\n"
+		      "pages mapped: %d unmapped: %d\n",
+		      atomic_read(&binder_alloc_stats.large_alloc),
+		      atomic_read(&binder_alloc_stats.failed),
+		      atomic_read(&binder_alloc_stats.drain),
+		      atomic_read(&binder_alloc_stats.pages_mapped),
+		      atomic_read(&binder_alloc_stats.pages_unmapped));
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (p >= end)
+			break;
+		p += snprintf(p, end - p, "proc %d: cached", proc->pid);
+		for (i = 0; i < BINDER_SIZE_CLASS_COUNT && p < end; i++)
+			p += snprintf(p, end - p, " %d",
+				      proc->size_class_cached[i]);
+		if (p < end)
+			p += snprintf(p, end - p, "\n");
+	}
+	if (do_lock)
+		up_write(&binder_main_lock);
+	if (p > end)
+		p = end;
+
+	*start = page + off;
+
+	len = p - page;
+	if (len > off)
+		len -= off;
+	else
+		len = 0;
+
+	return len < count ? len  : count;
+}
+
 static int procfs_binder_read_proc_transactions(char *page, char **start, off_t off,
 					 int count, int *eof, void *data)
 {
@@ -4073,7 +4884,7 @@ static int procfs_binder_read_proc_transactions(char *page, char **start, off_t
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	buf += snprintf(buf, end - buf, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
@@ -4082,7 +4893,7 @@ static int procfs_binder_read_proc_transactions(char *page, char **start, off_t
 		buf = procfs_print_binder_proc(buf, end, proc, 0);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	if (buf > page + PAGE_SIZE)
 		buf = page + PAGE_SIZE;
 
@@ -4109,11 +4920,11 @@ static int procfs_binder_read_proc_proc(char *page, char **start, off_t off,
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 	p += snprintf(p, PAGE_SIZE, "binder proc state:\n");
 	p = procfs_print_binder_proc(p, page + PAGE_SIZE, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 
 	if (p > page + PAGE_SIZE)
 		p = page + PAGE_SIZE;
@@ -4145,6 +4956,7 @@ static int procfs_binder_read_proc_transaction_log(
 	char *page, char **start, off_t off, int count, int *eof, void *data)
 {
 	struct binder_transaction_log *log = data;
+	int next = binder_transaction_log_next(log);
 	int len = 0;
 	int i;
 	char *buf = page;
@@ -4154,14 +4966,14 @@ static int procfs_binder_read_proc_transaction_log(
 		return 0;
 
 	if (log->full) {
-		for (i = log->next; i < ARRAY_SIZE(log->entry); i++) {
+		for (i = next; i < ARRAY_SIZE(log->entry); i++) {
 			if (buf >= end)
 				break;
 			buf = procfs_print_binder_transaction_log_entry(buf, end,
 								&log->entry[i]);
 		}
 	}
-	for (i = 0; i < log->next; i++) {
+	for (i = 0; i < next; i++) {
 		if (buf >= end)
 			break;
 		buf = procfs_print_binder_transaction_log_entry(buf, end,
@@ -4197,6 +5009,8 @@ static struct miscdevice binder_miscdev = {
 
 BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
+BINDER_DEBUG_ENTRY(alloc_stats);
+BINDER_DEBUG_ENTRY(latency);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
 
@@ -4228,6 +5042,16 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    NULL,
 				    &binder_stats_fops);
+		debugfs_create_file("alloc_stats",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_alloc_stats_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 		debugfs_create_file("transactions",
 				    S_IRUGO,
 				    binder_debugfs_dir_entry_root,
@@ -4256,6 +5080,11 @@ static int __init binder_init(void)
 				       binder_proc_dir_entry_root,
 				       procfs_binder_read_proc_stats,
 				       NULL);
+		create_proc_read_entry("alloc_stats",
+				       S_IRUGO,
+				       binder_proc_dir_entry_root,
+				       procfs_binder_read_proc_alloc_stats,
+				       NULL);
 		create_proc_read_entry("transactions",
 				       S_IRUGO,
 				       binder_proc_dir_entry_root,
@@ -91,6 +91,7 @@ struct binder_version {
 #define	BINDER_SET_CONTEXT_MGR		_IOW('b', 7, int)
 #define	BINDER_THREAD_EXIT		_IOW('b', 8, int)
 #define BINDER_VERSION			_IOWR('b', 9, struct binder_version)
+#define	BINDER_SET_ONEWAY_BATCH		_IOW('b', 10, int)
 
 /*
  * NOTE: Two special error codes you should check for when calling
@@ -0,0 +1,109 @@
+/* binder_trace.h
+ *
+ * Android IPC Subsystem
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(binder_transaction,
+	TP_PROTO(int debug_id, int reply, int to_node, int to_proc,
+		 int to_thread, unsigned int code, unsigned int flags),
+	TP_ARGS(debug_id, reply, to_node, to_proc, to_thread, code, flags),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, reply)
+		__field(int, to_node)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->reply = reply;
+		__entry->to_node = to_node;
+		__entry->to_proc = to_proc;
+		__entry->to_thread = to_thread;
+		__entry->code = code;
+		__entry->flags = flags;
+	),
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d "
+		  "reply=%d flags=0x%x code=0x%x",
+		  __entry->debug_id, __entry->to_node, __entry->to_proc,
+		  __entry->to_thread, __entry->reply, __entry->flags,
+		  __entry->code)
+);
+
+TRACE_EVENT(binder_transaction_received,
+	TP_PROTO(int debug_id, int node, int proc, s64 queue_us),
+	TP_ARGS(debug_id, node, proc, queue_us),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, node)
+		__field(int, proc)
+		__field(s64, queue_us)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->node = node;
+		__entry->proc = proc;
+		__entry->queue_us = queue_us;
+	),
+	TP_printk("transaction=%d node=%d proc=%d queue=%lldus",
+		  __entry->debug_id, __entry->node, __entry->proc,
+		  (long long)__entry->queue_us)
+);
+
+TRACE_EVENT(binder_transaction_reply,
+	TP_PROTO(int debug_id, int node, int proc, s64 service_us,
+		 s64 round_trip_us),
+	TP_ARGS(debug_id, node, proc, service_us, round_trip_us),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, node)
+		__field(int, proc)
+		__field(s64, service_us)
+		__field(s64, round_trip_us)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->node = node;
+		__entry->proc = proc;
+		__entry->service_us = service_us;
+		__entry->round_trip_us = round_trip_us;
+	),
+	TP_printk("transaction=%d node=%d proc=%d service=%lldus "
+		  "round_trip=%lldus",
+		  __entry->debug_id, __entry->node, __entry->proc,
+		  (long long)__entry->service_us,
+		  (long long)__entry->round_trip_us)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
@@ -25,6 +25,11 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/pagemap.h>
+#include <linux/io.h>
+#include <linux/lzo.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,35 +38,64 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * The ring buffer itself is not protected by a lock. Positions are free
+ * running byte counters that are reduced modulo the (power of two) size with
+ * logger_offset() to index the buffer. A writer reserves [w_pos, w_pos + len)
+ * with cmpxchg, pushes index->head past the entries it is about to
+ * overwrite, copies its entry in and finally publishes it by advancing
+ * index->tail. Entries are published in reservation order, so everything
+ * before index->tail is complete. Writers run with preemption disabled from
+ * reservation to commit, so at most one entry per CPU is in flight.
+ *
+ * The index and the ring are page aligned so that readers can mmap() them.
+ *
+ * The mutex 'mutex' only protects the list of readers. The archive fields
+ * are protected by archive_mutex.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	struct mutex		mutex;	/* mutex protecting readers */
+	struct logger_index	*index;	/* head and tail, shared with mmap */
+	__u32			w_pos;	/* next write reservation */
 	size_t			size;	/* size of the log */
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+	int			archive; /* keep an archive of this log? */
+	struct list_head	chunks;	/* archived chunks, oldest first */
+	size_t			archived; /* compressed size of 'chunks' */
+	__u32			a_pos;	/* archived up to here */
+	struct work_struct	work;	/* compresses the next chunk */
+#endif
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by reader->mutex.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes reads on this reader */
+	__u32			r_pos;	/* current read position */
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+	unsigned char		*chunk_buf; /* decompressed archive chunk */
+	__u32			chunk_start; /* position of 'chunk_buf' */
+	__u32			chunk_end; /* position after 'chunk_buf' */
+#endif
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* logger_before - is position 'a' before position 'b'? */
+#define logger_before(a, b)	((__s32)((a) - (b)) < 0)
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -89,12 +123,14 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * The result is only meaningful if the entry was not overwritten meanwhile,
+ * see reader_lapped().
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
 	__u16 val;
 
+	off = logger_offset(off);
 	switch (log->size - off) {
 	case 1:
 		memcpy(&val, log->buffer + off, 1);
@@ -107,17 +143,30 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 	return sizeof(struct logger_entry) + val;
 }
 
+/*
+ * reader_lapped - has the writer overwritten the entry at 'pos'?
+ *
+ * Call after reading from the buffer; the barrier orders those reads before
+ * the check of 'head', which writers advance before overwriting anything.
+ */
+static inline int reader_lapped(struct logger_log *log, __u32 pos)
+{
+	smp_rmb();
+	return logger_before(pos, ACCESS_ONCE(log->index->head));
+}
+
 /*
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
  * user-space buffer 'buf'. Returns 'count' on success.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
 				   char __user *buf,
 				   size_t count)
 {
+	size_t off = logger_offset(reader->r_pos);
 	size_t len;
 
 	/*
@@ -125,8 +174,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,11 +186,429 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+
+/*
+ * The archive keeps a compressed copy of the log's history. Whenever
+ * LOGGER_ARCHIVE_CHUNK bytes of entries have been published past 'a_pos',
+ * a worker LZO compresses them into a chunk before the writers come around
+ * to overwrite them. Chunks are dropped oldest first once they take up more
+ * than the size of the ring. Readers lapped by the writers continue in the
+ * archive instead of skipping ahead to the head, and new readers start at
+ * the oldest archived entry.
+ *
+ * All archives share one set of compression buffers, so archive_mutex
+ * protects those as well as every log's chunk list and 'a_pos'.
+ */
+#define LOGGER_ARCHIVE_CHUNK	(16 * 1024)
+
+struct logger_chunk {
+	struct list_head	list;	/* entry in logger_log's chunks */
+	__u32			start;	/* position of the first entry */
+	__u32			end;	/* position after the last entry */
+	size_t			len;	/* compressed length */
+	unsigned char		data[0];
+};
+
+static DEFINE_MUTEX(archive_mutex);
+static void *archive_wrkmem;
+static unsigned char *archive_src;
+static unsigned char *archive_dst;
+
+static void logger_archive_work(struct work_struct *work)
+{
+	struct logger_log *log = container_of(work, struct logger_log, work);
+	struct logger_chunk *chunk;
+
+	mutex_lock(&archive_mutex);
+	while (ACCESS_ONCE(log->index->tail) - log->a_pos >=
+	       LOGGER_ARCHIVE_CHUNK) {
+		__u32 tail = ACCESS_ONCE(log->index->tail);
+		__u32 pos = log->a_pos;
+		size_t off, len, n = 0;
+
+		/* whatever the writers already took is lost */
+		if (reader_lapped(log, pos)) {
+			log->a_pos = ACCESS_ONCE(log->index->head);
+			continue;
+		}
+
+		while (pos != tail) {
+			len = get_entry_len(log, pos);
+			if (n + len > LOGGER_ARCHIVE_CHUNK)
+				break;
+			pos += len;
+			n += len;
+		}
+
+		off = logger_offset(log->a_pos);
+		len = min(n, log->size - off);
+		memcpy(archive_src, log->buffer + off, len);
+		if (n != len)
+			memcpy(archive_src + len, log->buffer, n - len);
+		if (reader_lapped(log, log->a_pos))
+			continue;
+
+		if (lzo1x_1_compress(archive_src, n, archive_dst, &len,
+				     archive_wrkmem) != LZO_E_OK)
+			break;
+
+		chunk = kmalloc(sizeof(*chunk) + len, GFP_KERNEL);
+		if (!chunk)
+			break;
+		chunk->start = log->a_pos;
+		chunk->end = pos;
+		chunk->len = len;
+		memcpy(chunk->data, archive_dst, len);
+		list_add_tail(&chunk->list, &log->chunks);
+		log->archived += len;
+		log->a_pos = pos;
+
+		while (log->archived > log->size) {
+			chunk = list_first_entry(&log->chunks,
+						 struct logger_chunk, list);
+			list_del(&chunk->list);
+			log->archived -= chunk->len;
+			kfree(chunk);
+		}
+	}
+	mutex_unlock(&archive_mutex);
+}
+
+/*
+ * logger_archive_kick - called by writers after publishing an entry
+ */
+static inline void logger_archive_kick(struct logger_log *log, __u32 tail)
+{
+	if (log->archive && tail - ACCESS_ONCE(log->a_pos) >=
+	    LOGGER_ARCHIVE_CHUNK)
+		schedule_work(&log->work);
+}
+
+/*
+ * logger_archive_fixup - move a lapped reader to the first archived entry
+ * at or after its position. Returns 0 if there is none.
+ *
+ * Caller must hold reader->mutex.
+ */
+static int logger_archive_fixup(struct logger_log *log,
+				struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+	int ret = 0;
+
+	if (!log->archive)
+		return 0;
+
+	mutex_lock(&archive_mutex);
+	list_for_each_entry(chunk, &log->chunks, list) {
+		if (logger_before(reader->r_pos, chunk->end)) {
+			if (logger_before(reader->r_pos, chunk->start))
+				reader->r_pos = chunk->start;
+			ret = 1;
+			break;
+		}
+	}
+	mutex_unlock(&archive_mutex);
+
+	return ret;
+}
+
+/*
+ * logger_archive_load - make sure the chunk holding the reader's position
+ * is decompressed in the reader's buffer. Returns the length of the entry
+ * at that position, or -EAGAIN if the position is no longer archived.
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t logger_archive_load(struct logger_log *log,
+				   struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+	struct logger_entry *entry;
+	size_t len, off;
+	ssize_t ret = -EAGAIN;
+
+	if (!reader->chunk_buf) {
+		reader->chunk_buf = kmalloc(LOGGER_ARCHIVE_CHUNK, GFP_KERNEL);
+		if (!reader->chunk_buf)
+			return -ENOMEM;
+	}
+
+	if (logger_before(reader->r_pos, reader->chunk_start) ||
+	    !logger_before(reader->r_pos, reader->chunk_end)) {
+		mutex_lock(&archive_mutex);
+		list_for_each_entry(chunk, &log->chunks, list) {
+			if (logger_before(reader->r_pos, chunk->start))
+				break;
+			if (!logger_before(reader->r_pos, chunk->end))
+				continue;
+			len = LOGGER_ARCHIVE_CHUNK;
+			if (lzo1x_decompress_safe(chunk->data, chunk->len,
+						  reader->chunk_buf, &len) !=
+			    LZO_E_OK || len != chunk->end - chunk->start) {
+				ret = -EIO;
+				break;
+			}
+			reader->chunk_start = chunk->start;
+			reader->chunk_end = chunk->end;
+			ret = 0;
+			break;
+		}
+		mutex_unlock(&archive_mutex);
+		if (ret) {
+			reader->chunk_start = reader->chunk_end = 0;
+			return ret;
+		}
+	}
+
+	off = reader->r_pos - reader->chunk_start;
+	len = reader->chunk_end - reader->chunk_start;
+	entry = (struct logger_entry *) (reader->chunk_buf + off);
+	if (off + sizeof(struct logger_entry) > len ||
+	    off + sizeof(struct logger_entry) + entry->len > len)
+		return -EIO;
+
+	return sizeof(struct logger_entry) + entry->len;
+}
+
+/*
+ * logger_archive_seek - move the reader to the lapped position 'pos', which
+ * must be the start of an archived entry if it is archived at all.
+ *
+ * Caller must hold reader->mutex.
+ */
+static int logger_archive_seek(struct logger_log *log,
+			       struct logger_reader *reader, __u32 pos)
+{
+	struct logger_entry *entry;
+	__u32 old = reader->r_pos;
+	__u32 off;
+	ssize_t ret;
+
+	reader->r_pos = pos;
+	ret = logger_archive_load(log, reader);
+	if (ret == -EAGAIN)
+		return 0;	/* not archived, fix_up_reader() moves it on */
+	if (ret < 0)
+		goto fail;
+
+	/* chunks hold whole entries, so this stays inside the chunk */
+	off = reader->chunk_start;
+	while (logger_before(off, pos)) {
+		entry = (struct logger_entry *)
+			(reader->chunk_buf + (off - reader->chunk_start));
+		off += sizeof(struct logger_entry) + entry->len;
+	}
+	if (off == pos)
+		return 0;
+	ret = -EINVAL;
+fail:
+	reader->r_pos = old;
+	return ret;
+}
+
+/*
+ * logger_archive_read - read the archived entry at the reader's position
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t logger_archive_read(struct logger_log *log,
+				   struct logger_reader *reader,
+				   char __user *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = logger_archive_load(log, reader);
+	if (ret < 0)
+		return ret;
+	if (count < ret)
+		return -EINVAL;
+	if (copy_to_user(buf, reader->chunk_buf +
+			 (reader->r_pos - reader->chunk_start), ret))
+		return -EFAULT;
+	reader->r_pos += ret;
+
+	return ret;
+}
+
+/*
+ * logger_archive_oldest - where new readers of 'log' start
+ */
+static __u32 logger_archive_oldest(struct logger_log *log)
+{
+	__u32 pos = ACCESS_ONCE(log->index->head);
+	struct logger_chunk *chunk;
+
+	if (!log->archive)
+		return pos;
+
+	mutex_lock(&archive_mutex);
+	if (!list_empty(&log->chunks)) {
+		chunk = list_first_entry(&log->chunks, struct logger_chunk,
+					 list);
+		if (logger_before(chunk->start, pos))
+			pos = chunk->start;
+	}
+	mutex_unlock(&archive_mutex);
+
+	return pos;
+}
+
+/*
+ * logger_archive_flush - drop the archived history of 'log' up to 'tail'
+ */
+static void logger_archive_flush(struct logger_log *log, __u32 tail)
+{
+	struct logger_chunk *chunk, *next;
+
+	if (!log->archive)
+		return;
+
+	mutex_lock(&archive_mutex);
+	list_for_each_entry_safe(chunk, next, &log->chunks, list) {
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+	log->archived = 0;
+	if (logger_before(log->a_pos, tail))
+		log->a_pos = tail;
+	mutex_unlock(&archive_mutex);
+}
+
+static void logger_archive_release(struct logger_reader *reader)
+{
+	kfree(reader->chunk_buf);
+}
+
+static int __init logger_archive_init(struct logger_log *log)
+{
+	INIT_LIST_HEAD(&log->chunks);
+	INIT_WORK(&log->work, logger_archive_work);
+
+	/* keep the worker well ahead of the writers */
+	if (log->size < 4 * LOGGER_ARCHIVE_CHUNK)
+		return 0;
+
+	if (!archive_wrkmem) {
+		archive_wrkmem = vmalloc(LZO1X_MEM_COMPRESS);
+		archive_src = vmalloc(LOGGER_ARCHIVE_CHUNK);
+		archive_dst = vmalloc(lzo1x_worst_compress(LOGGER_ARCHIVE_CHUNK));
+		if (!archive_wrkmem || !archive_src || !archive_dst) {
+			vfree(archive_wrkmem);
+			vfree(archive_src);
+			vfree(archive_dst);
+			archive_wrkmem = NULL;
+			return -ENOMEM;
+		}
+	}
+	log->archive = 1;
+
+	return 0;
+}
+
+#else
+
+static inline void logger_archive_kick(struct logger_log *log, __u32 tail)
+{
+}
+
+static inline int logger_archive_fixup(struct logger_log *log,
+				       struct logger_reader *reader)
+{
+	return 0;
+}
+
+static inline ssize_t logger_archive_load(struct logger_log *log,
+					  struct logger_reader *reader)
+{
+	return -EAGAIN;
+}
+
+static inline ssize_t logger_archive_read(struct logger_log *log,
+					  struct logger_reader *reader,
+					  char __user *buf, size_t count)
+{
+	return -EAGAIN;
+}
+
+static inline int logger_archive_seek(struct logger_log *log,
+				      struct logger_reader *reader, __u32 pos)
+{
+	reader->r_pos = pos;
+	return 0;
+}
+
+static inline __u32 logger_archive_oldest(struct logger_log *log)
+{
+	return ACCESS_ONCE(log->index->head);
+}
+
+static inline void logger_archive_flush(struct logger_log *log, __u32 tail)
+{
+}
+
+static inline void logger_archive_release(struct logger_reader *reader)
+{
+}
+
+static inline int logger_archive_init(struct logger_log *log)
+{
+	return 0;
+}
+
+#endif /* CONFIG_ANDROID_LOGGER_ARCHIVE */
+
+/*
+ * fix_up_reader - if the writer lapped 'reader', pull it forward to the
+ * oldest entry still in the archive or, failing that, in the log. Returns
+ * the number of bytes left to read.
+ *
+ * Caller must hold reader->mutex.
+ */
+static size_t fix_up_reader(struct logger_log *log,
+			    struct logger_reader *reader)
+{
+	__u32 tail = ACCESS_ONCE(log->index->tail);
+	__u32 head;
+
+	smp_rmb();
+	head = ACCESS_ONCE(log->index->head);
+	if (logger_before(reader->r_pos, head) &&
+	    !logger_archive_fixup(log, reader))
+		reader->r_pos = head;
+	return tail - reader->r_pos;
+}
+
+/*
+ * is_entry_start - does an entry start at 'pos', which must lie in the log?
+ *
+ * Walks the entries up to 'pos' from 'from', a known entry boundary such as
+ * the reader's position, so a reader moving forward only pays for what it
+ * consumed; the walk starts at the head when 'from' was overwritten or lies
+ * beyond 'pos'. Readers must never be left off an entry boundary: the ring
+ * would otherwise hand out lengths read from inside a payload.
+ */
+static int is_entry_start(struct logger_log *log, __u32 from, __u32 pos)
+{
+	__u32 start, off;
+
+	do {
+		start = from;
+		if (logger_before(start, ACCESS_ONCE(log->index->head)) ||
+		    logger_before(pos, start))
+			start = ACCESS_ONCE(log->index->head);
+		off = start;
+		while (logger_before(off, pos))
+			off += get_entry_len(log, off);
+	} while (reader_lapped(log, start));
+
+	return off == pos;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -166,9 +633,7 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = (ACCESS_ONCE(log->index->tail) == reader->r_pos);
 		if (!ret)
 			break;
 
@@ -189,16 +654,27 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
 
+retry:
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(!fix_up_reader(log, reader))) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
+	/* lapped readers continue in the archive */
+	if (logger_before(reader->r_pos, ACCESS_ONCE(log->index->head))) {
+		ret = logger_archive_read(log, reader, buf, count);
+		if (ret == -EAGAIN)
+			goto retry;
+		goto out;
+	}
+
 	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
+	ret = get_entry_len(log, reader->r_pos);
+	if (reader_lapped(log, reader->r_pos))
+		goto retry;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
@@ -206,114 +682,96 @@ start:
 
 	/* get exactly one entry from the log */
 	ret = do_read_log_to_user(log, reader, buf, ret);
+	if (ret < 0)
+		goto out;
+
+	/* the writer may have lapped us while we copied; read again */
+	if (reader_lapped(log, reader->r_pos))
+		goto retry;
+	reader->r_pos += ret;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * make_room - pull 'head' forward until [new - size, new) holds no entry
+ * that starts before it, so the space up to 'new' may be overwritten.
  *
- * Caller must hold log->mutex.
+ * The header at 'head' cannot change while 'head' still points at it, so a
+ * length read there is valid whenever the cmpxchg below succeeds. Only
+ * complete entries are ever skipped because the log is larger than the most
+ * that can be in flight (one entry per CPU).
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void make_room(struct logger_log *log, __u32 new)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
+	__u32 head, next;
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	while (1) {
+		head = ACCESS_ONCE(log->index->head);
+		if (!logger_before(head, new - log->size))
+			break;
+		next = head + get_entry_len(log, head);
+		cmpxchg(&log->index->head, head, next);
 	}
-
-	return 0;
-}
-
-/*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
- */
-static void fix_up_readers(struct logger_log *log, size_t len)
-{
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos'
  *
- * The caller needs to hold log->mutex.
+ * The caller must own [pos, pos + count).
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, __u32 pos, const void *buf,
+			 size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * do_write_log_from_user - writes 'count' bytes from the user-space buffer
+ * 'buf' to the log 'log' at position 'pos'
  *
- * The caller needs to hold log->mutex.
+ * The caller must own [pos, pos + count) and have preemption disabled, so
+ * user pages are not faulted in here; the caller faults them in beforehand.
+ * Whatever could not be copied is zeroed.
  *
- * Returns 'count' on success, negative error code on failure.
+ * Returns 'count' on success, -EFAULT on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, __u32 pos,
 				      const void __user *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
+	size_t left = 0;
+
+	len = min(count, log->size - off);
+	pagefault_disable();
+	if (len)
+		left = __copy_from_user_inatomic(log->buffer + off, buf, len);
+	if (left)
+		memset(log->buffer + off + len - left, 0, left);
+
+	if (count != len) {
+		size_t left2;
+
+		left2 = __copy_from_user_inatomic(log->buffer, buf + len,
+						  count - len);
+		if (left2)
+			memset(log->buffer + count - len - left2, 0, left2);
+		left += left2;
+	}
+	pagefault_enable();
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
+	return left ? -EFAULT : count;
 }
 
 /*
@@ -325,10 +783,14 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	const struct iovec *seg;
+	unsigned long i;
 	struct logger_entry header;
 	struct timespec now;
+	__u32 pos;
+	size_t len;
 	ssize_t ret = 0;
+	int fault = 0;
 
 	now = current_kernel_time();
 
@@ -337,48 +799,75 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	/*
+	 * The copy below runs with preemption disabled, so fault the payload
+	 * in first. An entry never exceeds a page, so each segment touches at
+	 * most two pages.
+	 */
+	for (i = 0, seg = iov, len = header.len; i < nr_segs && len; i++, seg++) {
+		size_t n = min_t(size_t, seg->iov_len, len);
+
+		if (n && fault_in_pages_readable(seg->iov_base, n))
+			return -EFAULT;
+		len -= n;
+	}
+
+	len = sizeof(struct logger_entry) + header.len;
+
+	preempt_disable();
+
+	/* reserve our slot */
+	do {
+		pos = ACCESS_ONCE(log->w_pos);
+	} while (cmpxchg(&log->w_pos, pos, pos + len) != pos);
 
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * Pull the head forward to the first readable entry after (what will
+	 * be) the new write position. We do this now because readers must
+	 * notice they were lapped before their entries are clobbered.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	make_room(log, pos + len);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	do_write_log(log, pos, &header, sizeof(struct logger_entry));
 
-	while (nr_segs-- > 0) {
-		size_t len;
+	while (nr_segs-- > 0 && ret < header.len) {
+		size_t seg_len;
 		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		seg_len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
-		}
+		nr = do_write_log_from_user(log,
+				pos + sizeof(struct logger_entry) + ret,
+				iov->iov_base, seg_len);
+		if (unlikely(nr < 0))
+			fault = 1;
 
 		iov++;
-		ret += nr;
+		ret += seg_len;
 	}
 
-	mutex_unlock(&log->mutex);
+	/* publish in reservation order */
+	while (ACCESS_ONCE(log->index->tail) != pos)
+		cpu_relax();
+	smp_wmb();
+	log->index->tail = pos + len;
+
+	preempt_enable();
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
-	return ret;
+	logger_archive_kick(log, pos + len);
+
+	return fault ? -EFAULT : ret;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -404,15 +893,16 @@ static int logger_open(struct inode *inode, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader;
 
-		reader = kmalloc(sizeof(struct logger_reader), GFP_KERNEL);
+		reader = kzalloc(sizeof(struct logger_reader), GFP_KERNEL);
 		if (!reader)
 			return -ENOMEM;
 
 		reader->log = log;
 		INIT_LIST_HEAD(&reader->list);
+		mutex_init(&reader->mutex);
 
 		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
+		reader->r_pos = logger_archive_oldest(log);
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -436,6 +926,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 		mutex_lock(&log->mutex);
 		list_del(&reader->list);
 		mutex_unlock(&log->mutex);
+		logger_archive_release(reader);
 		kfree(reader);
 	}
 
@@ -465,10 +956,8 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	if (ACCESS_ONCE(log->index->tail) != reader->r_pos)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
@@ -479,8 +968,6 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -491,10 +978,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		ret = fix_up_reader(log, reader);
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -502,31 +988,103 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
+		mutex_lock(&reader->mutex);
+		while (1) {
 			ret = 0;
+			if (!fix_up_reader(log, reader))
+				break;
+			if (logger_before(reader->r_pos,
+					  ACCESS_ONCE(log->index->head))) {
+				ret = logger_archive_load(log, reader);
+				if (ret != -EAGAIN)
+					break;
+				continue;
+			}
+			ret = get_entry_len(log, reader->r_pos);
+			if (!reader_lapped(log, reader->r_pos))
+				break;
+		}
+		mutex_unlock(&reader->mutex);
+		break;
+	case LOGGER_SET_READ_POS:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		/*
+		 * Positions past the log are clamped, lapped ones are looked
+		 * up in the archive or fixed up.
+		 */
+		ret = 0;
+		if (logger_before(ACCESS_ONCE(log->index->tail), (__u32) arg))
+			reader->r_pos = ACCESS_ONCE(log->index->tail);
+		else if (logger_before(arg, ACCESS_ONCE(log->index->head)))
+			ret = logger_archive_seek(log, reader, arg);
+		else if (is_entry_start(log, reader->r_pos, arg))
+			reader->r_pos = arg;
+		else
+			ret = -EINVAL;
+		if (!ret)
+			ret = fix_up_reader(log, reader);
+		mutex_unlock(&reader->mutex);
 		break;
-	case LOGGER_FLUSH_LOG:
+	case LOGGER_FLUSH_LOG: {
+		__u32 tail, head;
+
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		mutex_lock(&log->mutex);
+		tail = ACCESS_ONCE(log->index->tail);
+		do {
+			head = ACCESS_ONCE(log->index->head);
+			if (!logger_before(head, tail))
+				break;
+		} while (cmpxchg(&log->index->head, head, tail) != head);
+		list_for_each_entry(reader, &log->readers, list) {
+			mutex_lock(&reader->mutex);
+			if (logger_before(reader->r_pos, tail))
+				reader->r_pos = tail;
+			mutex_unlock(&reader->mutex);
+		}
+		logger_archive_flush(log, tail);
+		mutex_unlock(&log->mutex);
 		ret = 0;
 		break;
 	}
-
-	mutex_unlock(&log->mutex);
+	}
 
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Readers may map the log read-only: the page at offset 0 holds the
+ * struct logger_index, the ring buffer follows at offset PAGE_SIZE, as
+ * they do in the vmalloc_user() area of the log.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EACCES;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	/* checks that the mapping lies within the area */
+	return remap_vmalloc_range(vma, log->index, vma->vm_pgoff);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
+	.mmap = logger_mmap,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
@@ -537,13 +1095,12 @@ static const struct file_operations logger_fops = {
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, at least PAGE_SIZE, greater than
+ * LOGGER_ENTRY_MAX_LEN times the number of CPUs, and less than LONG_MAX minus
+ * LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -553,8 +1110,7 @@ static struct logger_log VAR = { \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
-	.head = 0, \
+	.w_pos = 0, \
 	.size = SIZE, \
 };
 
@@ -580,17 +1136,50 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	/* make_room() must never skip an entry that is still being written */
+	if (log->size <= num_possible_cpus() * LOGGER_ENTRY_MAX_LEN) {
+		printk(KERN_ERR "logger: log '%s' too small for %d cpus\n",
+		       log->misc.name, num_possible_cpus());
+		return -EINVAL;
+	}
+
+	/*
+	 * The index page and the ring, in one zeroed area that can be
+	 * mapped to userspace, whether or not the driver is a module.
+	 */
+	log->index = vmalloc_user(PAGE_SIZE + log->size);
+	if (!log->index) {
+		printk(KERN_ERR "logger: failed to allocate log '%s'\n",
+		       log->misc.name);
+		return -ENOMEM;
+	}
+	log->index->size = log->size;
+	log->buffer = (unsigned char *) log->index + PAGE_SIZE;
+
+	ret = logger_archive_init(log);
+	if (unlikely(ret)) {
+		printk(KERN_ERR "logger: failed to set up the archive "
+		       "for log '%s'\n", log->misc.name);
+		goto out_free;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
-		return ret;
+		goto out_free;
 	}
 
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
 	return 0;
+
+out_free:
+	vfree(log->index);
+	log->index = NULL;
+	log->buffer = NULL;
+	return ret;
 }
 
 static int __init logger_init(void)
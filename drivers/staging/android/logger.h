@@ -30,6 +30,26 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * struct logger_index - first page of a log's read-only mmap() area; the ring
+ * buffer of 'size' bytes follows at offset PAGE_SIZE.
+ *
+ * Positions are free running byte counters, the entry at position 'pos'
+ * starts at byte (pos & (size - 1)) of the ring and may wrap around its end.
+ * Every entry in [head, tail) is complete. To consume entries, read 'tail',
+ * issue a read barrier, copy the entry at the current position and then
+ * check, after another read barrier, that 'head' did not move past that
+ * position; if it did the entry was overwritten and reading restarts at
+ * 'head'. LOGGER_SET_READ_POS hands the position back to the driver so
+ * that poll() reports new entries relative to it.
+ */
+struct logger_index {
+	__u32		head;	/* oldest entry in the log */
+	__u32		tail;	/* end of the newest complete entry */
+	__u32		size;	/* size of the ring buffer */
+	__u32		__pad;
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -45,5 +65,6 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_POS		_IO(__LOGGERIO, 5) /* set read pos */
 
 #endif /* _LINUX_LOGGER_H */
@@ -15,6 +15,13 @@
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
+ * To catch that, it also watches how much of what page reclaim scans it
+ * manages to free: once that drops below 100 - pressure_critical percent,
+ * caches no longer count as free. The resulting pressure level is exported
+ * in /sys/kernel/mm/lowmemorykiller/pressure_level, which can be poll()ed.
+ *
+ * Kills are done by the lowmemorykiller thread rather than in reclaim, so
+ * it can wait for a victim to exit before deciding whether to kill again.
  *
  * Copyright (C) 2007-2008 Google, Inc.
  *
@@ -35,6 +42,12 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/vmpressure.h>
 
 #ifdef CONFIG_SWAP
 #include <linux/fs.h>
@@ -71,11 +84,51 @@ static int lowmem_minfile_size = 6;
 
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_death_wait);
 static uint32_t lowmem_check_filepages = 0;
 #ifdef CONFIG_SWAP
 static int fudgeswap = 512;
 #endif
 
+/* the killer thread and what wakes it */
+static struct task_struct *lowmem_task;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_wait);
+static unsigned long lowmem_kicked;
+
+/*
+ * Reclaim efficiency from vmpressure, as one of these levels. The current
+ * level is shown, and poll()able, in
+ * /sys/kernel/mm/lowmemorykiller/pressure_level. Samples only come while
+ * reclaim runs, so a level that got none for LOWMEM_PRESSURE_DECAY is low.
+ */
+enum {
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+};
+
+static const char * const lowmem_pressure_names[] = {
+	"low",
+	"medium",
+	"critical",
+};
+
+#define LOWMEM_PRESSURE_DECAY	HZ
+
+/* highest oom_adj of a visible process; the page cache still protects it */
+#define LOWMEM_VISIBLE_ADJ	1
+
+static int lowmem_pressure_level;
+static unsigned long lowmem_pressure_stamp;
+static uint32_t lowmem_pressure_medium = 60;
+static uint32_t lowmem_pressure_critical = 95;
+static struct kobject *lowmem_kobj;
+
+/* what victim selection costs: passes, processes looked at, time spent */
+static unsigned long lowmem_scans;
+static unsigned long lowmem_scanned_tasks;
+static unsigned long lowmem_scan_ns;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level)) {	\
@@ -100,6 +153,7 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 		lowmem_deathpending = NULL;
 		lowmem_print(2, "deathpending end %d (%s)\n",
 			task->pid, task->comm);
+		wake_up(&lowmem_death_wait);
 	}
 
 	return NOTIFY_OK;
@@ -141,16 +195,19 @@ static void dump_deathpending(struct task_struct *t_deathpending)
 	read_unlock(&tasklist_lock);
 }
 
-static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+/*
+ * lowmem_min_adj - the lowest oom_adj that may be killed right now, or
+ * OOM_ADJUST_MAX + 1 if memory is not low.
+ *
+ * Under critical pressure, reclaim is failing to free the page cache, so it
+ * no longer counts as free memory when choosing among background processes.
+ * Foreground and visible ones keep the normal free + file test.
+ */
+static int lowmem_min_adj(int critical, int *free, int *file)
 {
-	struct task_struct *p;
-	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
 	int i;
+	int file_pages;
 	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
@@ -158,19 +215,6 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int lru_file = global_page_state(NR_ACTIVE_FILE) +
 			global_page_state(NR_INACTIVE_FILE);
 
-	/*
-	 * If we already have a death outstanding, then
-	 * bail out right away; indicating to vmscan
-	 * that we have nothing further to offer on
-	 * this pass.
-	 *
-	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-		dump_deathpending(lowmem_deathpending);
-		return 0;
-	}
-
 #ifdef CONFIG_SWAP
 	if(fudgeswap != 0){
 		struct sysinfo si;
@@ -190,8 +234,9 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
+		file_pages = critical && lowmem_adj[i] > LOWMEM_VISIBLE_ADJ ? 0 : other_file;
 		if (other_free < lowmem_minfree[i]) {
-			if (other_file < lowmem_minfree[i] ||
+			if (file_pages < lowmem_minfree[i] ||
 				(lowmem_check_filepages &&
 				(lru_file < lowmem_minfile[i]))) {
 
@@ -200,55 +245,98 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			}
 		}
 	}
-	if (nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
-			     nr_to_scan, gfp_mask, other_free, other_file,
-			     min_adj);
-	rem = global_page_state(NR_ACTIVE_ANON) +
-		global_page_state(NR_ACTIVE_FILE) +
-		global_page_state(NR_INACTIVE_ANON) +
-		global_page_state(NR_INACTIVE_FILE);
-	if (nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
-		lowmem_print(5, "lowmem_shrink %d, %x, return %d\n",
-			     nr_to_scan, gfp_mask, rem);
-		return rem;
+
+	*free = other_free;
+	*file = other_file;
+	return min_adj;
+}
+
+static int lowmem_get_pressure_level(void)
+{
+	int level = ACCESS_ONCE(lowmem_pressure_level);
+
+	if (level != LOWMEM_PRESSURE_LOW &&
+	    time_after(jiffies, ACCESS_ONCE(lowmem_pressure_stamp) +
+				LOWMEM_PRESSURE_DECAY))
+		level = LOWMEM_PRESSURE_LOW;
+	return level;
+}
+
+static void lowmem_wake(void)
+{
+	if (!test_and_set_bit(0, &lowmem_kicked))
+		wake_up(&lowmem_wait);
+}
+
+/*
+ * lowmem_kill - kill one process if memory is low. Returns 1 if it did.
+ *
+ * Called only by the killer thread. If the last victim has not exited yet,
+ * waits for it first, for at most a second after it was killed.
+ */
+static int lowmem_kill(int critical)
+{
+	struct task_struct *p;
+	struct task_struct *selected = NULL;
+	struct hlist_node *node;
+	ktime_t start;
+	int tasksize;
+	int adj;
+	int scanned = 0;
+	int min_adj;
+	int selected_tasksize = 0;
+	int selected_oom_adj;
+	int other_free, other_file;
+	unsigned long flags;
+	long timeout;
+
+	if (lowmem_deathpending) {
+		timeout = (long) (lowmem_deathpending_timeout - jiffies);
+		if (timeout > 0 &&
+		    !wait_event_timeout(lowmem_death_wait,
+					!lowmem_deathpending, timeout))
+			dump_deathpending(lowmem_deathpending);
 	}
-	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	min_adj = lowmem_min_adj(critical, &other_free, &other_file);
+	lowmem_print(3, "lowmem_kill %s, ofree %d %d, ma %d\n",
+		     lowmem_pressure_names[lowmem_get_pressure_level()],
+		     other_free, other_file, min_adj);
+	if (min_adj == OOM_ADJUST_MAX + 1)
+		return 0;
+	selected_oom_adj = min_adj;
+	if (min_adj < OOM_DISABLE)
+		min_adj = OOM_DISABLE;
 
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	/*
+	 * Only the processes with the highest oom_adj at or above min_adj
+	 * are candidates, and of those the largest is killed.
+	 */
+	start = ktime_get();
+	spin_lock_irqsave(&oom_adj_lock, flags);
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		hlist_for_each_entry(p, node, oom_adj_bucket(adj),
+				     oom_adj_node) {
+			struct mm_struct *mm;
+
+			scanned++;
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, adj,
+				     tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
@@ -257,11 +345,101 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
 	}
-	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
-		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
+	lowmem_scans++;
+	lowmem_scanned_tasks += scanned;
+	lowmem_scan_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_unlock_irqrestore(&oom_adj_lock, flags);
+	lowmem_print(4, "lowmem_kill scanned %d\n", scanned);
+
+	return selected != NULL;
+}
+
+/*
+ * lowmem_thread - the killer. It is woken by the shrinker when memory is
+ * low and by the reclaim efficiency notifier when pressure is above low,
+ * and keeps killing until memory is no longer low.
+ */
+static int lowmem_thread(void *unused)
+{
+	int notified = LOWMEM_PRESSURE_LOW;
+	int level;
+	long ret;
+
+	while (!kthread_should_stop()) {
+		/* above low, wake up in time to report the level decaying */
+		ret = wait_event_interruptible_timeout(lowmem_wait,
+					test_and_clear_bit(0, &lowmem_kicked) ||
+					kthread_should_stop(),
+					notified == LOWMEM_PRESSURE_LOW ?
+					MAX_SCHEDULE_TIMEOUT :
+					LOWMEM_PRESSURE_DECAY);
+
+		level = lowmem_get_pressure_level();
+		if (level != notified) {
+			sysfs_notify(lowmem_kobj, NULL, "pressure_level");
+			notified = level;
+		}
+		if (!ret)
+			continue;
+
+		while (!kthread_should_stop() &&
+		       lowmem_kill(level == LOWMEM_PRESSURE_CRITICAL))
+			level = lowmem_get_pressure_level();
+	}
+
+	return 0;
+}
+
+static int lowmem_vmpressure(struct notifier_block *self,
+			     unsigned long pressure, void *data)
+{
+	int level = LOWMEM_PRESSURE_LOW;
+
+	if (pressure >= lowmem_pressure_critical)
+		level = LOWMEM_PRESSURE_CRITICAL;
+	else if (pressure >= lowmem_pressure_medium)
+		level = LOWMEM_PRESSURE_MEDIUM;
+
+	lowmem_pressure_stamp = jiffies;
+	if (level != lowmem_pressure_level ||
+	    level != LOWMEM_PRESSURE_LOW) {
+		lowmem_pressure_level = level;
+		lowmem_wake();
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call	= lowmem_vmpressure,
+};
+
+static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	int rem;
+	int min_adj;
+	int other_free, other_file;
+
+	rem = global_page_state(NR_ACTIVE_ANON) +
+		global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_ANON) +
+		global_page_state(NR_INACTIVE_FILE);
+	if (nr_to_scan <= 0) {
+		lowmem_print(5, "lowmem_shrink %d, %x, return %d\n",
+			     nr_to_scan, gfp_mask, rem);
+		return rem;
+	}
+
+	/* the killer thread does the work, reclaim goes on meanwhile */
+	min_adj = lowmem_min_adj(lowmem_get_pressure_level() ==
+				 LOWMEM_PRESSURE_CRITICAL,
+				 &other_free, &other_file);
+	lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
+		     nr_to_scan, gfp_mask, other_free, other_file, min_adj);
+	if (min_adj != OOM_ADJUST_MAX + 1)
+		lowmem_wake();
+
 	return rem;
 }
 
@@ -270,17 +448,49 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static ssize_t pressure_level_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n",
+		       lowmem_pressure_names[lowmem_get_pressure_level()]);
+}
+
+static struct kobj_attribute pressure_level_attr = __ATTR_RO(pressure_level);
+
 static int __init lowmem_init(void)
 {
+	int ret;
+
+	lowmem_kobj = kobject_create_and_add("lowmemorykiller", mm_kobj);
+	if (!lowmem_kobj)
+		return -ENOMEM;
+	ret = sysfs_create_file(lowmem_kobj, &pressure_level_attr.attr);
+	if (ret)
+		goto err_kobj;
+
+	lowmem_task = kthread_run(lowmem_thread, NULL, "lowmemorykiller");
+	if (IS_ERR(lowmem_task)) {
+		ret = PTR_ERR(lowmem_task);
+		goto err_kobj;
+	}
+
 	task_free_register(&task_nb);
+	vmpressure_register_notifier(&lowmem_vmpressure_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
+
+err_kobj:
+	kobject_put(lowmem_kobj);
+	return ret;
 }
 
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	vmpressure_unregister_notifier(&lowmem_vmpressure_nb);
 	task_free_unregister(&task_nb);
+	kthread_stop(lowmem_task);
+	kobject_put(lowmem_kobj);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -289,6 +499,13 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(scans, lowmem_scans, ulong, S_IRUGO);
+module_param_named(scanned_tasks, lowmem_scanned_tasks, ulong, S_IRUGO);
+module_param_named(scan_ns, lowmem_scan_ns, ulong, S_IRUGO);
 
 module_param_named(check_filepages , lowmem_check_filepages, uint,
 		   S_IRUGO | S_IWUSR);
@@ -23,12 +23,15 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/vmalloc.h>
+#include <linux/vmpressure.h>
 
 #include "ramzswap_drv.h"
 
@@ -38,6 +41,10 @@ static struct ramzswap *devices;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
+static unsigned int writeback_interval = 60;
+static unsigned int writeback_age = 10;
+static unsigned int compact_pressure = 60;
+static unsigned int compact_min_frag = 25;
 
 static int rzs_test_flag(struct ramzswap *rzs, u32 index,
 			enum rzs_pageflags flag)
@@ -57,6 +64,17 @@ static void rzs_clear_flag(struct ramzswap *rzs, u32 index,
 	rzs->table[index].flags &= ~BIT(flag);
 }
 
+static enum rzs_algo rzs_get_algo(struct ramzswap *rzs, u32 index)
+{
+	return (rzs->table[index].flags & RZS_ALGO_MASK) >> RZS_ALGO_SHIFT;
+}
+
+static void rzs_set_algo(struct ramzswap *rzs, u32 index, enum rzs_algo algo)
+{
+	rzs->table[index].flags &= ~RZS_ALGO_MASK;
+	rzs->table[index].flags |= algo << RZS_ALGO_SHIFT;
+}
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -115,6 +133,22 @@ static void setup_swap_header(struct ramzswap *rzs, union swap_header *s)
 	memcpy(s->magic.magic, "SWAPSPACE2", 10);
 }
 
+/*
+ * Percentage of the compressed object pool that is free space scattered
+ * over partially used pages.
+ */
+static u32 ramzswap_frag_pct(struct ramzswap *rzs)
+{
+	u64 total, used;
+
+	total = xv_get_total_size_bytes(rzs->mem_pool);
+	used = xv_get_used_size_bytes(rzs->mem_pool);
+	if (!total)
+		return 0;
+
+	return div64_u64((total - used) * 100, total);
+}
+
 static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 			struct ramzswap_ioctl_stats *s)
 {
@@ -154,13 +188,106 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
 	s->compr_data_size = rs->compr_size;
 	s->mem_used_total = mem_used;
+	s->dedup_hits = rzs_stat64_read(rzs, &rs->dedup_hits);
+	s->pages_dedup = rs->pages_dedup;
+	s->num_writebacks = rzs_stat64_read(rzs, &rs->num_writebacks);
+	s->backing_reads = rzs_stat64_read(rzs, &rs->backing_reads);
+	s->pages_backed = rs->pages_backed;
+	s->frag_pct = ramzswap_frag_pct(rzs);
+	s->num_compactions = rzs_stat64_read(rzs, &rs->num_compactions);
+	s->compact_moved = rzs_stat64_read(rzs, &rs->compact_moved);
+	s->compact_freed = rzs_stat64_read(rzs, &rs->compact_freed);
 	}
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
+static struct hlist_head *dedup_bucket(struct ramzswap *rzs, u32 checksum)
+{
+	return &rzs->dedup_hash[hash_32(checksum, rzs->dedup_hash_bits)];
+}
+
+/*
+ * Look for an object holding the 'clen' bytes at 'cdata', compressed with
+ * 'algo'. Caller must hold rzs->dedup_lock.
+ */
+static struct rzs_dedup *dedup_find(struct ramzswap *rzs, u32 checksum,
+			enum rzs_algo algo, void *cdata, u32 clen)
+{
+	struct rzs_dedup *dedup;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+	int same;
+
+	hlist_for_each_entry(dedup, pos, dedup_bucket(rzs, checksum), hash) {
+		if (dedup->checksum != checksum || dedup->algo != algo)
+			continue;
+
+		cmem = kmap_atomic(dedup->page, KM_USER1) + dedup->offset;
+		same = xv_get_object_size(cmem) ==
+				clen + sizeof(struct zobj_header) &&
+			!memcmp(cmem + sizeof(struct zobj_header), cdata, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		if (same)
+			return dedup;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the index entry of the object at <page, offset>. Caller must hold
+ * rzs->dedup_lock.
+ */
+static struct rzs_dedup *dedup_lookup(struct ramzswap *rzs, struct page *page,
+			u32 offset, u32 checksum)
+{
+	struct rzs_dedup *dedup;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(dedup, pos, dedup_bucket(rzs, checksum), hash) {
+		if (dedup->page == page && dedup->offset == offset)
+			return dedup;
+	}
+
+	return NULL;
+}
+
+/*
+ * Drop a reference to the compressed object at <page, offset>. Returns
+ * 1 if that was the last one and the object should be freed.
+ */
+static int dedup_put(struct ramzswap *rzs, struct page *page, u32 offset,
+			u32 checksum)
+{
+	struct rzs_dedup *dedup;
+
+	spin_lock(&rzs->dedup_lock);
+	dedup = dedup_lookup(rzs, page, offset, checksum);
+	if (unlikely(!dedup)) {
+		spin_unlock(&rzs->dedup_lock);
+		/* should NEVER happen */
+		pr_err("Object not indexed! page=%p, offset=%u\n",
+			page, offset);
+		return 1;
+	}
+
+	if (--dedup->refcount) {
+		spin_unlock(&rzs->dedup_lock);
+		return 0;
+	}
+
+	hlist_del(&dedup->hash);
+	spin_unlock(&rzs->dedup_lock);
+	kfree(dedup);
+	return 1;
+}
+
+/*
+ * Free the memory holding page 'index'. Caller must hold rzs->lock.
+ */
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
-	u32 clen;
+	u32 clen, checksum;
 	void *obj;
 
 	struct page *page = rzs->table[index].page;
@@ -175,6 +302,7 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 			rzs_clear_flag(rzs, index, RZS_ZERO);
 			rzs_stat_dec(&rzs->stats.pages_zero);
 		}
+		rzs->table[index].age = 0;
 		return;
 	}
 
@@ -188,8 +316,16 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 
 	obj = kmap_atomic(page, KM_USER0) + offset;
 	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
+	checksum = ((struct zobj_header *)obj)->checksum;
 	kunmap_atomic(obj, KM_USER0);
 
+	/* other pages still share this object */
+	if (!dedup_put(rzs, page, offset, checksum)) {
+		rzs_stat_dec(&rzs->stats.pages_dedup);
+		rzs_stat_dec(&rzs->stats.pages_stored);
+		goto out_clear;
+	}
+
 	xv_free(rzs->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
@@ -198,8 +334,26 @@ out:
 	rzs->stats.compr_size -= clen;
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
+out_clear:
+
 	rzs->table[index].page = NULL;
 	rzs->table[index].offset = 0;
+	rzs->table[index].age = 0;
+}
+
+/*
+ * Empty slot 'index', whether swap freed it or is about to store to it
+ * again: drop its copy on the backing device too, and tell a writeback
+ * in progress that the page is gone. Caller must hold rzs->lock.
+ */
+static void ramzswap_free_slot(struct ramzswap *rzs, size_t index)
+{
+	ramzswap_free_page(rzs, index);
+	if (rzs_test_flag(rzs, index, RZS_BACKED)) {
+		rzs_clear_flag(rzs, index, RZS_BACKED);
+		rzs_stat_dec(&rzs->stats.pages_backed);
+	}
+	rzs_clear_flag(rzs, index, RZS_WRITEBACK);
 }
 
 static int handle_zero_page(struct bio *bio)
@@ -218,28 +372,42 @@ static int handle_zero_page(struct bio *bio)
 	return 0;
 }
 
-static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
+/*
+ * Copy the page stored at 'index' to 'page', decompressing it if needed.
+ * Caller must hold rzs->lock.
+ */
+static int ramzswap_copy_page(struct ramzswap *rzs, u32 index,
+			struct page *page)
 {
-	u32 index;
-	struct page *page;
+	int ret = 0;
+	unsigned int clen = PAGE_SIZE;
+	struct ramzswap_comp *comp;
+	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem;
 
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
 
-	memcpy(user_mem, cmem, PAGE_SIZE);
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	} else {
+		comp = per_cpu_ptr(rzs->comp, get_cpu());
+		ret = crypto_comp_decompress(
+			comp->tfm[rzs_get_algo(rzs, index)],
+			cmem + sizeof(*zheader),
+			xv_get_object_size(cmem) - sizeof(*zheader),
+			user_mem, &clen);
+		put_cpu();
+		if (!ret && clen != PAGE_SIZE)
+			ret = -EIO;
+	}
+
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
 
-	flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return 0;
+	return ret;
 }
 
 /*
@@ -265,43 +433,41 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
 	u32 index;
-	size_t clen;
 	struct page *page;
-	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
 
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	if (rzs_test_flag(rzs, index, RZS_ZERO))
+	spin_lock(&rzs->lock);
+
+	if (rzs_test_flag(rzs, index, RZS_ZERO)) {
+		spin_unlock(&rzs->lock);
 		return handle_zero_page(bio);
+	}
+
+	/* Page was written back, remap the request to the backing device */
+	if (rzs_test_flag(rzs, index, RZS_BACKED)) {
+		spin_unlock(&rzs->lock);
+		rzs_stat64_inc(rzs, &rzs->stats.backing_reads);
+		bio->bi_bdev = rzs->backing_bdev;
+		return 1;
+	}
 
 	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
+	if (!rzs->table[index].page) {
+		spin_unlock(&rzs->lock);
 		return handle_ramzswap_fault(rzs, bio);
+	}
 
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(rzs, bio);
-
-	user_mem = kmap_atomic(page, KM_USER0);
-	clen = PAGE_SIZE;
-
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
-
-	ret = lzo1x_decompress_safe(
-		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
-		user_mem, &clen);
+	rzs->table[index].age = 0;
+	ret = ramzswap_copy_page(rzs, index, page);
 
-	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+	spin_unlock(&rzs->lock);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
@@ -319,102 +485,203 @@ out:
 	return 0;
 }
 
+/*
+ * Incompressible pages are stored as-is (uncompressed) since we do not want
+ * to return too many swap write errors which has side effect of hanging the
+ * system.
+ */
+static int ramzswap_write_uncompressed(struct ramzswap *rzs, struct bio *bio)
+{
+	u32 index;
+	struct page *page, *page_store;
+	unsigned char *user_mem, *cmem;
+
+	page = bio->bi_io_vec[0].bv_page;
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+	if (unlikely(!page_store)) {
+		pr_info("Error allocating memory for incompressible "
+			"page: %u\n", index);
+		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
+		bio_io_error(bio);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = kmap_atomic(page_store, KM_USER1);
+	memcpy(cmem, user_mem, PAGE_SIZE);
+	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	spin_lock(&rzs->lock);
+	ramzswap_free_slot(rzs, index);
+	rzs->table[index].page = page_store;
+	rzs->table[index].offset = 0;
+	rzs->table[index].age = 0;
+	rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
+	rzs_stat_inc(&rzs->stats.pages_expand);
+	rzs->stats.compr_size += PAGE_SIZE;
+	rzs_stat_inc(&rzs->stats.pages_stored);
+	spin_unlock(&rzs->lock);
+
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return 0;
+}
+
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
-	u32 offset, index;
-	size_t clen;
+	u32 offset = 0, index, checksum;
+	unsigned int clen, alloc_len = 0;
+	enum rzs_algo algo;
 	struct zobj_header *zheader;
-	struct page *page, *page_store;
-	unsigned char *user_mem, *cmem, *src;
+	struct ramzswap_comp *comp;
+	struct rzs_dedup *dedup, *found;
+	struct page *page, *page_store = NULL;
+	unsigned char *user_mem, *cmem;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
 
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
+		spin_lock(&rzs->lock);
+		/* a swap cache page may be written to its slot again */
+		ramzswap_free_slot(rzs, index);
 		rzs_stat_inc(&rzs->stats.pages_zero);
 		rzs_set_flag(rzs, index, RZS_ZERO);
+		rzs->table[index].age = 0;
+		spin_unlock(&rzs->lock);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	/* index entry for the object, unless an identical one exists */
+	dedup = kmalloc(sizeof(*dedup), GFP_NOIO);
+	if (unlikely(!dedup)) {
+		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
+		goto out;
+	}
+
+	/*
+	 * Compress into this CPU's buffer and copy the result out before
+	 * giving up the CPU. Only non-sleeping allocations are possible in
+	 * between; if one fails, the object is allocated where we may sleep
+	 * and the page is compressed again.
+	 */
+compress_again:
+	/* the backend's tfms are set up before it is published */
+	algo = ACCESS_ONCE(rzs->algo);
+	smp_rmb();
+	comp = per_cpu_ptr(rzs->comp, get_cpu());
 
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(comp->tfm[algo], user_mem, PAGE_SIZE,
+				comp->buffer, &clen);
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		put_cpu();
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
+		if (page_store)
+			xv_free(rzs->mem_pool, page_store, offset);
+		kfree(dedup);
 		goto out;
 	}
 
-	/*
-	 * Page is incompressible. Store it as-is (uncompressed)
-	 * since we do not want to return too many swap write
-	 * errors which has side effect of hanging the system.
-	 */
 	if (unlikely(clen > max_zpage_size)) {
-		clen = PAGE_SIZE;
-		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
-			pr_info("Error allocating memory for incompressible "
-				"page: %u\n", index);
-			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
-			goto out;
-		}
+		put_cpu();
+		if (page_store)
+			xv_free(rzs->mem_pool, page_store, offset);
+		kfree(dedup);
+		return ramzswap_write_uncompressed(rzs, bio);
+	}
 
-		offset = 0;
-		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_inc(&rzs->stats.pages_expand);
-		rzs->table[index].page = page_store;
-		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
+	checksum = jhash(comp->buffer, clen, algo);
+	spin_lock(&rzs->dedup_lock);
+	found = dedup_find(rzs, checksum, algo, comp->buffer, clen);
+	if (found) {
+		found->refcount++;
+		spin_unlock(&rzs->dedup_lock);
+		put_cpu();
+		if (page_store)
+			xv_free(rzs->mem_pool, page_store, offset);
+		kfree(dedup);
+
+		rzs_stat64_inc(rzs, &rzs->stats.dedup_hits);
+		spin_lock(&rzs->lock);
+		ramzswap_free_slot(rzs, index);
+		rzs->table[index].page = found->page;
+		rzs->table[index].offset = found->offset;
+		rzs->table[index].age = 0;
+		rzs_set_algo(rzs, index, algo);
+		rzs_stat_inc(&rzs->stats.pages_stored);
+		rzs_stat_inc(&rzs->stats.pages_dedup);
+		spin_unlock(&rzs->lock);
+		goto done;
 	}
+	spin_unlock(&rzs->dedup_lock);
 
-	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
-			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
-		goto out;
+	/* the page changed under us; the object no longer fits exactly */
+	if (page_store && alloc_len != clen) {
+		xv_free(rzs->mem_pool, page_store, offset);
+		page_store = NULL;
 	}
 
-memstore:
-	rzs->table[index].offset = offset;
+	if (!page_store && xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
+			&page_store, &offset, GFP_NOWAIT | __GFP_HIGHMEM)) {
+		put_cpu();
+		if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
+				&page_store, &offset,
+				GFP_NOIO | __GFP_HIGHMEM)) {
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%u\n", index, clen);
+			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
+			kfree(dedup);
+			goto out;
+		}
+		alloc_len = clen;
+		goto compress_again;
+	}
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = kmap_atomic(page_store, KM_USER1) + offset;
 
-#if 0
+	zheader = (struct zobj_header *)cmem;
 	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+	zheader->table_idx = index;
+	zheader->checksum = checksum;
+	cmem += sizeof(*zheader);
 
-	memcpy(cmem, src, clen);
+	memcpy(cmem, comp->buffer, clen);
 
 	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	put_cpu();
+
+	dedup->page = page_store;
+	dedup->offset = offset;
+	dedup->algo = algo;
+	dedup->checksum = checksum;
+	dedup->refcount = 1;
+	spin_lock(&rzs->dedup_lock);
+	hlist_add_head(&dedup->hash, dedup_bucket(rzs, checksum));
+	spin_unlock(&rzs->dedup_lock);
+
+	spin_lock(&rzs->lock);
+	ramzswap_free_slot(rzs, index);
+	rzs->table[index].page = page_store;
+	rzs->table[index].offset = offset;
+	rzs->table[index].age = 0;
+	rzs_set_algo(rzs, index, algo);
 
 	/* Update stats */
 	rzs->stats.compr_size += clen;
@@ -422,8 +689,9 @@ memstore:
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
 
-	mutex_unlock(&rzs->lock);
+	spin_unlock(&rzs->lock);
 
+done:
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return 0;
@@ -433,6 +701,245 @@ out:
 	return 0;
 }
 
+static void ramzswap_backing_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int ramzswap_backing_write(struct ramzswap *rzs, u32 index,
+			struct page *page)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = rzs->backing_bdev;
+	bio->bi_sector = index << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = ramzswap_backing_end_io;
+	bio->bi_private = &done;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+
+	submit_bio(WRITE, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+/*
+ * Move page 'index' to the backing device if it is incompressible or has
+ * not been read for writeback_age passes. 'bounce' holds the page while
+ * it is being written.
+ */
+static void ramzswap_writeback_page(struct ramzswap *rzs, u32 index,
+			struct page *bounce)
+{
+	int ret;
+
+	spin_lock(&rzs->lock);
+
+	if (!rzs->table[index].page ||
+	    rzs_test_flag(rzs, index, RZS_WRITEBACK)) {
+		spin_unlock(&rzs->lock);
+		return;
+	}
+
+	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED) &&
+	    rzs->table[index].age++ < writeback_age) {
+		spin_unlock(&rzs->lock);
+		return;
+	}
+
+	ret = ramzswap_copy_page(rzs, index, bounce);
+	if (!ret)
+		rzs_set_flag(rzs, index, RZS_WRITEBACK);
+
+	spin_unlock(&rzs->lock);
+
+	if (ret)
+		return;
+
+	ret = ramzswap_backing_write(rzs, index, bounce);
+
+	spin_lock(&rzs->lock);
+
+	/* the page may have been freed, and even stored again, meanwhile */
+	if (!ret && rzs_test_flag(rzs, index, RZS_WRITEBACK)) {
+		ramzswap_free_page(rzs, index);
+		rzs_set_flag(rzs, index, RZS_BACKED);
+		rzs_stat_inc(&rzs->stats.pages_backed);
+		rzs_stat64_inc(rzs, &rzs->stats.num_writebacks);
+	}
+	rzs_clear_flag(rzs, index, RZS_WRITEBACK);
+
+	spin_unlock(&rzs->lock);
+}
+
+static void ramzswap_writeback_work(struct work_struct *work)
+{
+	u32 index;
+	struct page *bounce;
+	struct ramzswap *rzs = container_of(work, struct ramzswap,
+					writeback_work.work);
+
+	bounce = alloc_page(GFP_KERNEL);
+	if (bounce) {
+		/* page 0 is the swap header */
+		for (index = 1; index < rzs->disksize >> PAGE_SHIFT; index++) {
+			ramzswap_writeback_page(rzs, index, bounce);
+			cond_resched();
+		}
+		__free_page(bounce);
+	}
+
+	schedule_delayed_work(&rzs->writeback_work,
+				writeback_interval * HZ);
+}
+
+/*
+ * Only objects referenced by the table entry that stored them are moved,
+ * since entries sharing an object through dedup are not tracked.
+ * Called with rzs->lock and rzs->dedup_lock held.
+ */
+static int ramzswap_can_move(void *priv, struct page *page, u32 offset)
+{
+	u32 index, checksum;
+	struct ramzswap *rzs = priv;
+	struct zobj_header *zheader;
+	struct rzs_dedup *dedup;
+
+	zheader = kmap_atomic(page, KM_USER0) + offset;
+	index = zheader->table_idx;
+	checksum = zheader->checksum;
+	kunmap_atomic(zheader, KM_USER0);
+
+	if (index >= rzs->disksize >> PAGE_SHIFT ||
+	    rzs->table[index].page != page ||
+	    rzs->table[index].offset != offset)
+		return 0;
+
+	dedup = dedup_lookup(rzs, page, offset, checksum);
+	return dedup && dedup->refcount == 1;
+}
+
+static void ramzswap_moved(void *priv, struct page *page, u32 offset,
+			struct page *newpage, u32 newoffset)
+{
+	u32 index, checksum;
+	struct ramzswap *rzs = priv;
+	struct zobj_header *zheader;
+	struct rzs_dedup *dedup;
+
+	zheader = kmap_atomic(newpage, KM_USER0) + newoffset;
+	index = zheader->table_idx;
+	checksum = zheader->checksum;
+	kunmap_atomic(zheader, KM_USER0);
+
+	rzs->table[index].page = newpage;
+	rzs->table[index].offset = newoffset;
+
+	dedup = dedup_lookup(rzs, page, offset, checksum);
+	dedup->page = newpage;
+	dedup->offset = newoffset;
+}
+
+static const struct xv_compact_ops ramzswap_compact_ops = {
+	.can_move	= ramzswap_can_move,
+	.moved		= ramzswap_moved,
+};
+
+/*
+ * Move compressed objects out of sparsely used pool pages so that those
+ * pages can be freed. Pages are handled one at a time to keep lock hold
+ * times short. Caller must hold rzs->compact_lock, with init_done set.
+ */
+static void __ramzswap_compact(struct ramzswap *rzs,
+			struct ramzswap_ioctl_compact *c)
+{
+	u64 nr_pages;
+	u32 nr_moved = 0, nr_freed = 0;
+
+	c->pages_before = xv_get_total_size_bytes(rzs->mem_pool) >> PAGE_SHIFT;
+	c->frag_pct_before = ramzswap_frag_pct(rzs);
+
+	for (nr_pages = c->pages_before; nr_pages; nr_pages--) {
+		spin_lock(&rzs->lock);
+		spin_lock(&rzs->dedup_lock);
+		nr_freed += xv_compact_page(rzs->mem_pool, compact_max_used,
+				&ramzswap_compact_ops, rzs, &nr_moved);
+		spin_unlock(&rzs->dedup_lock);
+		spin_unlock(&rzs->lock);
+		cond_resched();
+	}
+
+	c->pages_after = xv_get_total_size_bytes(rzs->mem_pool) >> PAGE_SHIFT;
+	c->frag_pct_after = ramzswap_frag_pct(rzs);
+	c->objs_moved = nr_moved;
+	c->pages_freed = nr_freed;
+
+	rzs_stat64_inc(rzs, &rzs->stats.num_compactions);
+	rzs_stat64_add(rzs, &rzs->stats.compact_moved, nr_moved);
+	rzs_stat64_add(rzs, &rzs->stats.compact_freed, nr_freed);
+}
+
+static void ramzswap_compact(struct ramzswap *rzs,
+			struct ramzswap_ioctl_compact *c)
+{
+	mutex_lock(&rzs->compact_lock);
+	if (rzs->init_done)
+		__ramzswap_compact(rzs, c);
+	mutex_unlock(&rzs->compact_lock);
+}
+
+static void ramzswap_compact_work(struct work_struct *work)
+{
+	struct ramzswap_ioctl_compact c;
+	struct ramzswap *rzs = container_of(work, struct ramzswap,
+					compact_work);
+
+	/* the pool is only there while init_done, which the lock holds */
+	mutex_lock(&rzs->compact_lock);
+	if (!rzs->init_done || ramzswap_frag_pct(rzs) < compact_min_frag) {
+		mutex_unlock(&rzs->compact_lock);
+		return;
+	}
+
+	memset(&c, 0, sizeof(c));
+	__ramzswap_compact(rzs, &c);
+	mutex_unlock(&rzs->compact_lock);
+
+	pr_debug("Compacted: %llu -> %llu pages, %u%% -> %u%% fragmented\n",
+		c.pages_before, c.pages_after,
+		c.frag_pct_before, c.frag_pct_after);
+}
+
+/* Compact all devices when reclaim starts to struggle */
+static int ramzswap_vmpressure(struct notifier_block *self,
+			unsigned long pressure, void *data)
+{
+	int i;
+
+	if (!compact_pressure || pressure < compact_pressure)
+		return NOTIFY_DONE;
+
+	for (i = 0; i < num_devices; i++) {
+		if (devices[i].init_done)
+			schedule_work(&devices[i].compact_work);
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block ramzswap_vmpressure_nb = {
+	.notifier_call	= ramzswap_vmpressure,
+};
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -484,40 +991,129 @@ static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
+static void free_comp_buffers(struct ramzswap *rzs)
+{
+	int cpu;
+
+	if (!rzs->comp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct ramzswap_comp *comp = per_cpu_ptr(rzs->comp, cpu);
+		int algo;
+
+		for (algo = 0; algo < __NR_RZS_ALGOS; algo++)
+			if (comp->tfm[algo])
+				crypto_free_comp(comp->tfm[algo]);
+		free_pages((unsigned long)comp->buffer, 1);
+	}
+
+	free_percpu(rzs->comp);
+	rzs->comp = NULL;
+}
+
+/*
+ * Set up every CPU's tfm for the given backend. Those of backends used
+ * before are kept, since pages compressed with them may still be read.
+ */
+static int alloc_comp_tfms(struct ramzswap *rzs, enum rzs_algo algo)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct ramzswap_comp *comp = per_cpu_ptr(rzs->comp, cpu);
+		struct crypto_comp *tfm;
+
+		if (comp->tfm[algo])
+			continue;
+
+		tfm = crypto_alloc_comp(rzs_algo_names[algo], 0, 0);
+		if (IS_ERR(tfm)) {
+			pr_err("Error allocating %s compressor\n",
+				rzs_algo_names[algo]);
+			return PTR_ERR(tfm);
+		}
+		comp->tfm[algo] = tfm;
+	}
+
+	return 0;
+}
+
+static int alloc_comp_buffers(struct ramzswap *rzs)
+{
+	int cpu;
+
+	rzs->comp = alloc_percpu(struct ramzswap_comp);
+	if (!rzs->comp)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct ramzswap_comp *comp = per_cpu_ptr(rzs->comp, cpu);
+
+		comp->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!comp->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 static void reset_device(struct ramzswap *rzs)
 {
 	size_t index;
 
 	/* Do not accept any new I/O request */
+	mutex_lock(&rzs->compact_lock);
 	rzs->init_done = 0;
+	mutex_unlock(&rzs->compact_lock);
+	cancel_work_sync(&rzs->compact_work);
+
+	if (rzs->backing_bdev) {
+		cancel_delayed_work_sync(&rzs->writeback_work);
+		close_bdev_exclusive(rzs->backing_bdev,
+				FMODE_READ | FMODE_WRITE);
+		rzs->backing_bdev = NULL;
+	}
 
 	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
-
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+	free_comp_buffers(rzs);
 
 	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
+	for (index = 0; rzs->table && index < rzs->disksize >> PAGE_SHIFT;
+			index++) {
 		struct page *page;
-		u16 offset;
 
 		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
 
 		if (!page)
 			continue;
 
+		/* compressed objects may be shared, free them below */
 		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
 			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
 	}
 
 	vfree(rzs->table);
 	rzs->table = NULL;
 
+	if (rzs->dedup_hash) {
+		for (index = 0; index < 1 << rzs->dedup_hash_bits; index++) {
+			struct rzs_dedup *dedup;
+			struct hlist_node *pos, *n;
+
+			hlist_for_each_entry_safe(dedup, pos, n,
+					&rzs->dedup_hash[index], hash) {
+				xv_free(rzs->mem_pool, dedup->page,
+					dedup->offset);
+				kfree(dedup);
+			}
+		}
+		vfree(rzs->dedup_hash);
+		rzs->dedup_hash = NULL;
+	}
+
 	xv_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
 
@@ -527,6 +1123,35 @@ static void reset_device(struct ramzswap *rzs)
 	rzs->disksize = 0;
 }
 
+static int ramzswap_open_backing_dev(struct ramzswap *rzs)
+{
+	struct block_device *bdev;
+	size_t size, disksize = rzs->disksize;
+
+	bdev = open_bdev_exclusive(rzs->backing_name,
+				FMODE_READ | FMODE_WRITE, rzs);
+	if (IS_ERR(bdev)) {
+		pr_err("Error opening backing device %s\n", rzs->backing_name);
+		return PTR_ERR(bdev);
+	}
+
+	/* pages keep their offset, so the backing device must be as large */
+	size = i_size_read(bdev->bd_inode) & PAGE_MASK;
+	if (!disksize)
+		disksize = size;
+	if (size < disksize) {
+		pr_err("Backing device %s is smaller than the disk size\n",
+			rzs->backing_name);
+		close_bdev_exclusive(bdev, FMODE_READ | FMODE_WRITE);
+		return -EINVAL;
+	}
+
+	rzs->backing_bdev = bdev;
+	rzs->disksize = disksize;
+	pr_info("Using backing device %s\n", rzs->backing_name);
+	return 0;
+}
+
 static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 {
 	int ret;
@@ -539,21 +1164,21 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 		return -EBUSY;
 	}
 
+	if (rzs->backing_name[0]) {
+		ret = ramzswap_open_backing_dev(rzs);
+		if (ret)
+			goto fail;
+	}
+
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
+	ret = alloc_comp_buffers(rzs);
+	if (ret)
 		goto fail;
-	}
 
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = alloc_comp_tfms(rzs, rzs->algo);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = rzs->disksize >> PAGE_SHIFT;
 	rzs->table = vmalloc(num_pages * sizeof(*rzs->table));
@@ -566,6 +1191,18 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 	memset(rzs->table, 0, num_pages * sizeof(*rzs->table));
 
+	/* about one bucket for every eight pages */
+	rzs->dedup_hash_bits = max(ilog2(num_pages) - 3, 4);
+	rzs->dedup_hash = vmalloc(sizeof(*rzs->dedup_hash) <<
+					rzs->dedup_hash_bits);
+	if (!rzs->dedup_hash) {
+		pr_err("Error allocating deduplication index\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(rzs->dedup_hash, 0, sizeof(*rzs->dedup_hash) <<
+					rzs->dedup_hash_bits);
+
 	page = alloc_page(__GFP_ZERO);
 	if (!page) {
 		pr_err("Error allocating swap header page\n");
@@ -593,6 +1230,10 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	rzs->init_done = 1;
 
+	if (rzs->backing_bdev && writeback_interval)
+		schedule_delayed_work(&rzs->writeback_work,
+					writeback_interval * HZ);
+
 	pr_debug("Initialization done!\n");
 	return 0;
 
@@ -603,6 +1244,33 @@ fail:
 	return ret;
 }
 
+static int ramzswap_ioctl_set_algo(struct ramzswap *rzs, const char *name)
+{
+	int ret = 0;
+	enum rzs_algo algo;
+
+	for (algo = 0; algo < __NR_RZS_ALGOS; algo++)
+		if (!strcmp(name, rzs_algo_names[algo]))
+			break;
+
+	if (algo == __NR_RZS_ALGOS || !crypto_has_comp(name, 0, 0)) {
+		pr_info("Compressor %s not available\n", name);
+		return -EINVAL;
+	}
+
+	mutex_lock(&rzs->algo_lock);
+	if (rzs->init_done)
+		ret = alloc_comp_tfms(rzs, algo);
+	if (!ret) {
+		smp_wmb();
+		rzs->algo = algo;
+		pr_info("Using %s compressor\n", name);
+	}
+	mutex_unlock(&rzs->algo_lock);
+
+	return ret;
+}
+
 static int ramzswap_ioctl_reset_device(struct ramzswap *rzs)
 {
 	if (rzs->init_done)
@@ -656,9 +1324,56 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		break;
 	}
 	case RZSIO_INIT:
+		mutex_lock(&rzs->algo_lock);
 		ret = ramzswap_ioctl_init_device(rzs);
+		mutex_unlock(&rzs->algo_lock);
+		break;
+
+	case RZSIO_SET_BACKING_DEV:
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(rzs->backing_name, (void *)arg,
+					sizeof(rzs->backing_name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		rzs->backing_name[sizeof(rzs->backing_name) - 1] = '\0';
 		break;
 
+	case RZSIO_SET_ALGO:
+	{
+		char name[RZS_MAX_ALGO_NAME];
+
+		if (copy_from_user(name, (void *)arg, sizeof(name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		ret = ramzswap_ioctl_set_algo(rzs, name);
+		break;
+	}
+
+	case RZSIO_COMPACT:
+	{
+		struct ramzswap_ioctl_compact c;
+
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		memset(&c, 0, sizeof(c));
+		ramzswap_compact(rzs, &c);
+		pr_info("Compacted: %llu -> %llu pages, "
+			"%u%% -> %u%% fragmented\n",
+			c.pages_before, c.pages_after,
+			c.frag_pct_before, c.frag_pct_after);
+		if (copy_to_user((void *)arg, &c, sizeof(c)))
+			ret = -EFAULT;
+		break;
+	}
+
 	case RZSIO_RESET:
 		/* Do not reset an active device! */
 		if (bdev->bd_holders) {
@@ -687,7 +1402,11 @@ void ramzswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct ramzswap *rzs;
 
 	rzs = bdev->bd_disk->private_data;
-	ramzswap_free_page(rzs, index);
+
+	spin_lock(&rzs->lock);
+	ramzswap_free_slot(rzs, index);
+	spin_unlock(&rzs->lock);
+
 	rzs_stat64_inc(rzs, &rzs->stats.notify_free);
 
 	return;
@@ -703,7 +1422,12 @@ static int create_device(struct ramzswap *rzs, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&rzs->lock);
+	spin_lock_init(&rzs->lock);
+	mutex_init(&rzs->algo_lock);
+	spin_lock_init(&rzs->dedup_lock);
+	INIT_DELAYED_WORK(&rzs->writeback_work, ramzswap_writeback_work);
+	mutex_init(&rzs->compact_lock);
+	INIT_WORK(&rzs->compact_work, ramzswap_compact_work);
 	spin_lock_init(&rzs->stat64_lock);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
@@ -796,6 +1520,8 @@ static int __init ramzswap_init(void)
 			goto free_devices;
 	}
 
+	vmpressure_register_notifier(&ramzswap_vmpressure_nb);
+
 	return 0;
 
 free_devices:
@@ -812,6 +1538,8 @@ static void __exit ramzswap_exit(void)
 	int i;
 	struct ramzswap *rzs;
 
+	vmpressure_unregister_notifier(&ramzswap_vmpressure_nb);
+
 	for (i = 0; i < num_devices; i++) {
 		rzs = &devices[i];
 
@@ -829,6 +1557,32 @@ static void __exit ramzswap_exit(void)
 module_param(num_devices, uint, 0);
 MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
 
+module_param(writeback_interval, uint, 0644);
+MODULE_PARM_DESC(writeback_interval,
+	"Seconds between writebacks to the backing device (0: none)");
+
+static int ramzswap_set_writeback_age(const char *val, struct kernel_param *kp)
+{
+	unsigned long age;
+
+	if (strict_strtoul(val, 0, &age) || age > max_writeback_age)
+		return -EINVAL;
+	writeback_age = age;
+	return 0;
+}
+module_param_call(writeback_age, ramzswap_set_writeback_age, param_get_uint,
+	&writeback_age, 0644);
+MODULE_PARM_DESC(writeback_age,
+	"Writeback passes (0-255) a page must go unread before it is written back");
+
+module_param(compact_pressure, uint, 0644);
+MODULE_PARM_DESC(compact_pressure,
+	"Reclaim pressure (0-100) at which to compact (0: never)");
+
+module_param(compact_min_frag, uint, 0644);
+MODULE_PARM_DESC(compact_min_frag,
+	"Fragmentation (%) below which pressure does not compact");
+
 module_init(ramzswap_init);
 module_exit(ramzswap_exit);
 
@@ -17,6 +17,8 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
+#include <linux/workqueue.h>
 
 #include "ramzswap_ioctl.h"
 #include "xvmalloc.h"
@@ -27,6 +29,9 @@
  */
 static const unsigned max_num_devices = 32;
 
+/* Largest writeback_age that table[].age, a u8, can count up to. */
+static const unsigned max_writeback_age = 255;
+
 /*
  * Stored at beginning of each compressed object.
  *
@@ -34,9 +39,8 @@ static const unsigned max_num_devices = 32;
  * object. This is required to support memory defragmentation.
  */
 struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
+	u32 table_idx;	/* entry that stored it; others may share it */
+	u32 checksum;	/* of the compressed data, for deduplication */
 };
 
 /*-- Configurable parameters */
@@ -50,6 +54,12 @@ static const unsigned default_disksize_perc_ram = 25;
  */
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
+/*
+ * Compaction empties pool pages with at most this many bytes allocated,
+ * moving their objects into free space in other pages.
+ */
+static const unsigned compact_max_used = PAGE_SIZE / 2;
+
 /*
  * NOTE: max_zpage_size must be less than or equal to:
  *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
@@ -71,9 +81,34 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page is stored on the backing device only */
+	RZS_BACKED,
+
+	/* Page is being written to the backing device */
+	RZS_WRITEBACK,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
+/*
+ * Compression backends, named as in the crypto API. The backend that
+ * compressed a page is kept in the upper bits of table[page_no].flags, so
+ * the backend of a device can be changed while it holds pages.
+ */
+enum rzs_algo {
+	RZS_ALGO_LZO,
+	RZS_ALGO_DEFLATE,
+	__NR_RZS_ALGOS,
+};
+
+static const char * const rzs_algo_names[__NR_RZS_ALGOS] = {
+	[RZS_ALGO_LZO]		= "lzo",
+	[RZS_ALGO_DEFLATE]	= "deflate",
+};
+
+#define RZS_ALGO_SHIFT		4
+#define RZS_ALGO_MASK		(3 << RZS_ALGO_SHIFT)
+
 /*-- Data structures */
 
 /*
@@ -83,7 +118,7 @@ enum rzs_pageflags {
 struct table {
 	struct page *page;
 	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	u8 age;		/* writeback passes since last access */
 	u8 flags;
 } __attribute__((aligned(4)));
 
@@ -103,16 +138,50 @@ struct ramzswap_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u64 dedup_hits;		/* writes that found an identical object */
+	u32 pages_dedup;	/* no. of pages sharing another's object */
+	u64 num_writebacks;	/* pages written to the backing device */
+	u64 backing_reads;	/* reads served by the backing device */
+	u32 pages_backed;	/* no. of pages on the backing device only */
+	u64 num_compactions;	/* compaction passes run */
+	u64 compact_moved;	/* objects moved by compaction */
+	u64 compact_freed;	/* pool pages freed by compaction */
 #endif
 };
 
+/*
+ * Every compressed object is indexed by the checksum in its header, so
+ * that pages which compress to the same data share one object.
+ */
+struct rzs_dedup {
+	struct hlist_node hash;	/* in ramzswap->dedup_hash */
+	struct page *page;	/* the object */
+	u16 offset;
+	u8 algo;		/* backend that compressed it */
+	u32 checksum;
+	u32 refcount;		/* table entries pointing at it */
+};
+
+/*
+ * Per-CPU compression state, so that swap-out on different CPUs is not
+ * serialized through a single buffer.
+ */
+struct ramzswap_comp {
+	struct crypto_comp *tfm[__NR_RZS_ALGOS];
+	void *buffer;
+};
+
 struct ramzswap {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct ramzswap_comp __percpu *comp;
 	struct table *table;
+	struct hlist_head *dedup_hash;
+	unsigned int dedup_hash_bits;
+	spinlock_t dedup_lock;	/* protects dedup_hash and refcounts */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
+	spinlock_t lock;	/* protects table entries and 32-bit stats */
+	struct mutex algo_lock;	/* protects algo changes */
+	enum rzs_algo algo;	/* backend for new pages */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -123,6 +192,19 @@ struct ramzswap {
 	 */
 	size_t disksize;	/* bytes */
 
+	/*
+	 * Optional backing device. Incompressible pages, and pages not read
+	 * for writeback_age writeback passes, are moved there, to the same
+	 * offset they have on the ramzswap device.
+	 */
+	char backing_name[RZS_MAX_BACKING_NAME];
+	struct block_device *backing_bdev;
+	struct delayed_work writeback_work;
+
+	/* compaction, on request or under memory pressure */
+	struct mutex compact_lock;
+	struct work_struct compact_work;
+
 	struct ramzswap_stats stats;
 };
 
@@ -147,6 +229,13 @@ static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
 	spin_unlock(&rzs->stat64_lock);
 }
 
+static void rzs_stat64_add(struct ramzswap *rzs, u64 *v, u64 n)
+{
+	spin_lock(&rzs->stat64_lock);
+	*v = *v + n;
+	spin_unlock(&rzs->stat64_lock);
+}
+
 static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 {
 	u64 val;
@@ -161,6 +250,7 @@ static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 #define rzs_stat_inc(v)
 #define rzs_stat_dec(v)
 #define rzs_stat64_inc(r, v)
+#define rzs_stat64_add(r, v, n)
 #define rzs_stat64_read(r, v)
 #endif /* CONFIG_RAMZSWAP_STATS */
 
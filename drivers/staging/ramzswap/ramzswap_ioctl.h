@@ -15,6 +15,12 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+/* e.g. "lzo" or "deflate" */
+#define RZS_MAX_ALGO_NAME	16
+
+/* path of the backing block device */
+#define RZS_MAX_BACKING_NAME	128
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -32,11 +38,33 @@ struct ramzswap_ioctl_stats {
 	u64 orig_data_size;
 	u64 compr_data_size;
 	u64 mem_used_total;
+	u64 dedup_hits;		/* writes that found an identical page */
+	u32 pages_dedup;	/* no. of pages sharing another's memory */
+	u64 num_writebacks;	/* pages written to the backing device */
+	u64 backing_reads;	/* reads served by the backing device */
+	u32 pages_backed;	/* no. of pages on the backing device only */
+	u32 frag_pct;		/* % of mem_used_total not holding objects */
+	u64 num_compactions;	/* compaction passes run */
+	u64 compact_moved;	/* objects moved by compaction */
+	u64 compact_freed;	/* pages freed by compaction */
+} __attribute__ ((packed, aligned(4)));
+
+/* Result of one compaction pass */
+struct ramzswap_ioctl_compact {
+	u64 pages_before;	/* pages used by compressed objects */
+	u64 pages_after;
+	u32 frag_pct_before;	/* % of those pages not holding objects */
+	u32 frag_pct_after;
+	u64 objs_moved;
+	u64 pages_freed;
 } __attribute__ ((packed, aligned(4)));
 
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_ALGO		_IOW('z', 4, char[RZS_MAX_ALGO_NAME])
+#define RZSIO_SET_BACKING_DEV	_IOW('z', 5, char[RZS_MAX_BACKING_NAME])
+#define RZSIO_COMPACT		_IOR('z', 6, struct ramzswap_ioctl_compact)
 
 #endif
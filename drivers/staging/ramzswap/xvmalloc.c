@@ -14,6 +14,7 @@
 #include <linux/errno.h>
 #include <linux/highmem.h>
 #include <linux/init.h>
+#include <linux/module.h>
 #include <linux/string.h>
 #include <linux/slab.h>
 
@@ -284,9 +285,9 @@ static int grow_pool(struct xv_pool *pool, gfp_t flags)
 	if (unlikely(!page))
 		return -ENOMEM;
 
-	stat_inc(&pool->total_pages);
-
 	spin_lock(&pool->lock);
+	stat_inc(&pool->total_pages);
+	list_add_tail(&page->lru, &pool->pages);
 	block = get_ptr_atomic(page, 0, KM_USER0);
 
 	block->size = PAGE_SIZE - XV_ALIGN;
@@ -317,14 +318,64 @@ struct xv_pool *xv_create_pool(void)
 		return NULL;
 
 	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->pages);
 
 	return pool;
 }
+EXPORT_SYMBOL_GPL(xv_create_pool);
 
 void xv_destroy_pool(struct xv_pool *pool)
 {
 	kfree(pool);
 }
+EXPORT_SYMBOL_GPL(xv_destroy_pool);
+
+/*
+ * Allocate 'size' bytes from the free block at <page, offset>, found by
+ * find_block() in freelist 'index', splitting off what is left of it.
+ * Called with pool->lock held.
+ */
+static void alloc_block(struct xv_pool *pool, struct page *page, u32 offset,
+			u32 index, u32 origsize)
+{
+	u32 size, tmpsize, tmpoffset;
+	struct block_header *block, *tmpblock;
+
+	size = ALIGN(origsize, XV_ALIGN);
+	block = get_ptr_atomic(page, offset, KM_USER0);
+
+	remove_block_head(pool, block, index);
+
+	/* Split the block if required */
+	tmpoffset = offset + size + XV_ALIGN;
+	tmpsize = block->size - size;
+	tmpblock = (struct block_header *)((char *)block + size + XV_ALIGN);
+	if (tmpsize) {
+		tmpblock->size = tmpsize - XV_ALIGN;
+		set_flag(tmpblock, BLOCK_FREE);
+		clear_flag(tmpblock, PREV_FREE);
+
+		set_blockprev(tmpblock, offset);
+		if (tmpblock->size >= XV_MIN_ALLOC_SIZE)
+			insert_block(pool, page, tmpoffset, tmpblock);
+
+		if (tmpoffset + XV_ALIGN + tmpblock->size != PAGE_SIZE) {
+			tmpblock = BLOCK_NEXT(tmpblock);
+			set_blockprev(tmpblock, tmpoffset);
+		}
+	} else {
+		/* This block is exact fit */
+		if (tmpoffset != PAGE_SIZE)
+			clear_flag(tmpblock, PREV_FREE);
+	}
+
+	block->size = origsize;
+	clear_flag(block, BLOCK_FREE);
+
+	put_ptr_atomic(block, KM_USER0);
+
+	pool->used_bytes += size + XV_ALIGN;
+}
 
 /**
  * xv_malloc - Allocate block of given size from pool.
@@ -343,18 +394,14 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 		u32 *offset, gfp_t flags)
 {
 	int error;
-	u32 index, tmpsize, origsize, tmpoffset;
-	struct block_header *block, *tmpblock;
+	u32 index;
 
 	*page = NULL;
 	*offset = 0;
-	origsize = size;
 
 	if (unlikely(!size || size > XV_MAX_ALLOC_SIZE))
 		return -ENOMEM;
 
-	size = ALIGN(size, XV_ALIGN);
-
 	spin_lock(&pool->lock);
 
 	index = find_block(pool, size, page, offset);
@@ -376,56 +423,23 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 		return -ENOMEM;
 	}
 
-	block = get_ptr_atomic(*page, *offset, KM_USER0);
-
-	remove_block_head(pool, block, index);
-
-	/* Split the block if required */
-	tmpoffset = *offset + size + XV_ALIGN;
-	tmpsize = block->size - size;
-	tmpblock = (struct block_header *)((char *)block + size + XV_ALIGN);
-	if (tmpsize) {
-		tmpblock->size = tmpsize - XV_ALIGN;
-		set_flag(tmpblock, BLOCK_FREE);
-		clear_flag(tmpblock, PREV_FREE);
-
-		set_blockprev(tmpblock, *offset);
-		if (tmpblock->size >= XV_MIN_ALLOC_SIZE)
-			insert_block(pool, *page, tmpoffset, tmpblock);
-
-		if (tmpoffset + XV_ALIGN + tmpblock->size != PAGE_SIZE) {
-			tmpblock = BLOCK_NEXT(tmpblock);
-			set_blockprev(tmpblock, tmpoffset);
-		}
-	} else {
-		/* This block is exact fit */
-		if (tmpoffset != PAGE_SIZE)
-			clear_flag(tmpblock, PREV_FREE);
-	}
-
-	block->size = origsize;
-	clear_flag(block, BLOCK_FREE);
-
-	put_ptr_atomic(block, KM_USER0);
+	alloc_block(pool, *page, *offset, index, size);
 	spin_unlock(&pool->lock);
 
 	*offset += XV_ALIGN;
 
 	return 0;
 }
+EXPORT_SYMBOL_GPL(xv_malloc);
 
 /*
- * Free block identified with <page, offset>
+ * Free the block header at <page, offset>. Called with pool->lock held.
  */
-void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
+static void free_block(struct xv_pool *pool, struct page *page, u32 offset)
 {
 	void *page_start;
 	struct block_header *block, *tmpblock;
 
-	offset -= XV_ALIGN;
-
-	spin_lock(&pool->lock);
-
 	page_start = get_ptr_atomic(page, 0, KM_USER0);
 	block = (struct block_header *)((char *)page_start + offset);
 
@@ -433,6 +447,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	BUG_ON(test_flag(block, BLOCK_FREE));
 
 	block->size = ALIGN(block->size, XV_ALIGN);
+	pool->used_bytes -= block->size + XV_ALIGN;
 
 	tmpblock = BLOCK_NEXT(block);
 	if (offset + block->size + XV_ALIGN == PAGE_SIZE)
@@ -469,10 +484,10 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	/* No used objects in this page. Free it. */
 	if (block->size == PAGE_SIZE - XV_ALIGN) {
 		put_ptr_atomic(page_start, KM_USER0);
-		spin_unlock(&pool->lock);
+		stat_dec(&pool->total_pages);
+		list_del(&page->lru);
 
 		__free_page(page);
-		stat_dec(&pool->total_pages);
 		return;
 	}
 
@@ -487,8 +502,171 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	}
 
 	put_ptr_atomic(page_start, KM_USER0);
+}
+
+/*
+ * Free block identified with <page, offset>
+ */
+void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
+{
+	spin_lock(&pool->lock);
+	free_block(pool, page, offset - XV_ALIGN);
 	spin_unlock(&pool->lock);
 }
+EXPORT_SYMBOL_GPL(xv_free);
+
+/*
+ * Offset of the first allocated block in 'page' at or after the block
+ * header at 'offset', or PAGE_SIZE if there is none. If 'used' is given,
+ * the footprint of all allocated blocks from there on is added to it.
+ */
+static u32 next_used_block(struct page *page, u32 offset, u32 *used)
+{
+	u32 next = PAGE_SIZE;
+	char *page_start;
+	struct block_header *block;
+
+	page_start = get_ptr_atomic(page, 0, KM_USER0);
+	while (offset < PAGE_SIZE) {
+		block = (struct block_header *)(page_start + offset);
+		if (!test_flag(block, BLOCK_FREE)) {
+			if (next == PAGE_SIZE)
+				next = offset;
+			if (!used)
+				break;
+			*used += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+		}
+		offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+	}
+	put_ptr_atomic(page_start, KM_USER0);
+
+	return next;
+}
+
+/*
+ * Take the free blocks of 'page' off (isolate) or put them back on the
+ * freelists, so that objects moved out of it are not placed back into it.
+ */
+static void isolate_page(struct xv_pool *pool, struct page *page,
+			int isolate)
+{
+	u32 offset = 0;
+	char *page_start;
+	struct block_header *block;
+
+	while (offset < PAGE_SIZE) {
+		page_start = get_ptr_atomic(page, 0, KM_USER0);
+		block = (struct block_header *)(page_start + offset);
+		if (test_flag(block, BLOCK_FREE) &&
+		    block->size >= XV_MIN_ALLOC_SIZE) {
+			if (isolate)
+				remove_block(pool, page, offset, block,
+					get_index_for_insert(block->size));
+			else
+				insert_block(pool, page, offset, block);
+		}
+		offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+		put_ptr_atomic(page_start, KM_USER0);
+	}
+}
+
+/**
+ * xv_compact_page - try to free one page of the pool
+ * @pool: pool to compact
+ * @max_used: only pages with at most this many bytes allocated are emptied
+ * @ops: callbacks to check and redirect references to moved objects
+ * @priv: passed to @ops
+ * @nr_moved: incremented by the number of objects moved
+ *
+ * Looks at the next page of the pool, in round-robin order, and if it is
+ * sparse enough, moves its objects into free space elsewhere in the pool.
+ * The pool never grows while doing so. Returns 1 if the page was freed,
+ * 0 otherwise. The caller must make sure the objects are not accessed
+ * concurrently, and calls this once per page for a full pass.
+ */
+int xv_compact_page(struct xv_pool *pool, u32 max_used,
+			const struct xv_compact_ops *ops, void *priv,
+			u32 *nr_moved)
+{
+	u32 index, offset, next, stop, used = 0;
+	u32 newoffset, size = 0;
+	char *src, *dest;
+	struct page *page, *newpage;
+	struct block_header *block;
+
+	spin_lock(&pool->lock);
+
+	if (list_empty(&pool->pages)) {
+		spin_unlock(&pool->lock);
+		return 0;
+	}
+
+	page = list_first_entry(&pool->pages, struct page, lru);
+	list_move_tail(&page->lru, &pool->pages);
+
+	/* an empty page has just been added by xv_malloc() */
+	offset = next_used_block(page, 0, &used);
+	if (!used || used > max_used)
+		goto out;
+
+	/* Moving only some of the objects would not free anything */
+	for (; offset < PAGE_SIZE; offset = next_used_block(page,
+			offset + ALIGN(size, XV_ALIGN) + XV_ALIGN, NULL)) {
+		block = get_ptr_atomic(page, offset, KM_USER0);
+		size = block->size;
+		put_ptr_atomic(block, KM_USER0);
+		if (!ops->can_move(priv, page, offset + XV_ALIGN))
+			goto out;
+	}
+
+	isolate_page(pool, page, 1);
+
+	for (offset = next_used_block(page, 0, NULL); offset < PAGE_SIZE;
+	     offset = next_used_block(page,
+			offset + ALIGN(size, XV_ALIGN) + XV_ALIGN, NULL)) {
+		block = get_ptr_atomic(page, offset, KM_USER0);
+		size = block->size;
+		put_ptr_atomic(block, KM_USER0);
+
+		newpage = NULL;
+		index = find_block(pool, ALIGN(size, XV_ALIGN), &newpage,
+					&newoffset);
+		if (!newpage)
+			break;
+		alloc_block(pool, newpage, newoffset, index, size);
+		newoffset += XV_ALIGN;
+
+		src = get_ptr_atomic(page, offset + XV_ALIGN, KM_USER0);
+		dest = get_ptr_atomic(newpage, newoffset, KM_USER1);
+		memcpy(dest, src, size);
+		put_ptr_atomic(dest, KM_USER1);
+		put_ptr_atomic(src, KM_USER0);
+
+		ops->moved(priv, page, offset + XV_ALIGN, newpage, newoffset);
+		(*nr_moved)++;
+	}
+	stop = offset;
+
+	isolate_page(pool, page, 0);
+
+	/* Free what was moved; the page goes with the last object */
+	for (offset = next_used_block(page, 0, NULL); offset < stop;
+	     offset = next) {
+		block = get_ptr_atomic(page, offset, KM_USER0);
+		next = offset + ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+		put_ptr_atomic(block, KM_USER0);
+		next = next_used_block(page, next, NULL);
+		free_block(pool, page, offset);
+	}
+
+	spin_unlock(&pool->lock);
+	return stop == PAGE_SIZE;
+
+out:
+	spin_unlock(&pool->lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(xv_compact_page);
 
 u32 xv_get_object_size(void *obj)
 {
@@ -497,6 +675,7 @@ u32 xv_get_object_size(void *obj)
 	blk = (struct block_header *)((char *)(obj) - XV_ALIGN);
 	return blk->size;
 }
+EXPORT_SYMBOL_GPL(xv_get_object_size);
 
 /*
  * Returns total memory used by allocator (userdata + metadata)
@@ -505,3 +684,14 @@ u64 xv_get_total_size_bytes(struct xv_pool *pool)
 {
 	return pool->total_pages << PAGE_SHIFT;
 }
+EXPORT_SYMBOL_GPL(xv_get_total_size_bytes);
+
+/*
+ * Returns memory in allocated blocks; the rest of the total is fragmented
+ * free space
+ */
+u64 xv_get_used_size_bytes(struct xv_pool *pool)
+{
+	return pool->used_bytes;
+}
+EXPORT_SYMBOL_GPL(xv_get_used_size_bytes);
@@ -26,5 +26,22 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset);
 
 u32 xv_get_object_size(void *obj);
 u64 xv_get_total_size_bytes(struct xv_pool *pool);
+u64 xv_get_used_size_bytes(struct xv_pool *pool);
+
+/*
+ * Callbacks for xv_compact_page(), called with the pool lock held.
+ * can_move() says whether the object at <page, offset> may be relocated;
+ * moved() is called once it has been copied to <newpage, newoffset>, and
+ * must redirect all references to it.
+ */
+struct xv_compact_ops {
+	int (*can_move)(void *priv, struct page *page, u32 offset);
+	void (*moved)(void *priv, struct page *page, u32 offset,
+			struct page *newpage, u32 newoffset);
+};
+
+int xv_compact_page(struct xv_pool *pool, u32 max_used,
+			const struct xv_compact_ops *ops, void *priv,
+			u32 *nr_moved);
 
 #endif
@@ -0,0 +1,756 @@
+/*
+ * zcache - compressed cache for clean page cache pages
+ *
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * zcache is a cleancache backend: pages which drop out of the page cache
+ * of a cleancache-enabled filesystem are LZO-compressed into an xvmalloc
+ * pool, and a later read of the same page is served from there instead of
+ * going to the disk. The pool is kept to zcache.max_pct of RAM, does not
+ * take pages while free memory is below zcache.min_free_pct of RAM, and is
+ * shrunk, oldest page first, by memory pressure.
+ *
+ * With CONFIG_FRONTSWAP, zcache also takes pages being swapped out, in the
+ * same pool, so that swap-out and swap-in of compressible pages do not go
+ * through the block layer at all.
+ */
+
+#define KMSG_COMPONENT "zcache"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/cleancache.h>
+#include <linux/debugfs.h>
+#include <linux/frontswap.h>
+#include <linux/hash.h>
+#include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/list.h>
+#include <linux/lzo.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/radix-tree.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmalloc.h>
+#include <linux/vmstat.h>
+
+#include "../ramzswap/xvmalloc.h"
+
+#define ZCACHE_MAX_POOLS	16
+#define ZCACHE_OBJ_HASH_BITS	8
+
+/* Pages compressing to more than this are not worth keeping */
+#define ZCACHE_MAX_CLEN		(PAGE_SIZE / 2)
+
+/*
+ * Puts come in with the mapping's tree_lock held and interrupts disabled,
+ * so allocations must not sleep; they must not dip into reserves either.
+ */
+#define ZCACHE_GFP_MASK		(__GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC)
+
+/* A file, as identified by cleancache */
+struct zcache_obj {
+	struct hlist_node hash;		/* in its pool's objs */
+	struct cleancache_filekey key;
+	struct radix_tree_root pages;	/* page index -> zcache_page */
+	unsigned long nr_pages;
+};
+
+/* A compressed page */
+struct zcache_page {
+	struct list_head lru;		/* in zcache_lru, oldest first */
+	struct zcache_obj *obj;
+	pgoff_t index;
+	struct page *page;		/* <page, offset> of the data */
+	u32 offset;
+	u32 len;
+};
+
+/* The files of one filesystem */
+struct zcache_pool {
+	struct hlist_head objs[1 << ZCACHE_OBJ_HASH_BITS];
+};
+
+/*
+ * zcache_lock protects the pools, their objects and pages, and the LRU.
+ * Interrupts must be disabled while holding it.
+ */
+static DEFINE_SPINLOCK(zcache_lock);
+static struct zcache_pool *zcache_pools[ZCACHE_MAX_POOLS];
+static LIST_HEAD(zcache_lru);
+static struct xv_pool *zcache_xv;
+
+static struct kmem_cache *zcache_obj_cachep;
+static struct kmem_cache *zcache_page_cachep;
+
+/* Per-CPU compression buffers, used with interrupts disabled */
+static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
+static DEFINE_PER_CPU(void *, zcache_wrkmem);
+
+/* Module params (documentation at end) */
+static unsigned int zcache_max_pct = 10;
+static unsigned int zcache_min_free_pct = 5;
+
+/* Stats, protected by zcache_lock */
+static u64 zcache_hits;
+static u64 zcache_misses;
+static u64 zcache_puts;
+static u64 zcache_put_rejects;
+static u64 zcache_evicts;
+static u64 zcache_flushes;
+static u64 zcache_stored_pages;
+static u64 zcache_pool_pages;
+
+static struct dentry *zcache_debugfs_dir;
+
+static struct zcache_pool *zcache_pool(int pool_id)
+{
+	if (pool_id < 0 || pool_id >= ZCACHE_MAX_POOLS)
+		return NULL;
+	return zcache_pools[pool_id];
+}
+
+static struct hlist_head *zcache_obj_bucket(struct zcache_pool *pool,
+			struct cleancache_filekey *key)
+{
+	u32 hash = jhash2(key->u.key, CLEANCACHE_KEY_MAX, 0);
+
+	return &pool->objs[hash_32(hash, ZCACHE_OBJ_HASH_BITS)];
+}
+
+static struct zcache_obj *zcache_obj_find(struct zcache_pool *pool,
+			struct cleancache_filekey *key)
+{
+	struct zcache_obj *obj;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(obj, pos, zcache_obj_bucket(pool, key), hash) {
+		if (!memcmp(&obj->key, key, sizeof(*key)))
+			return obj;
+	}
+
+	return NULL;
+}
+
+static struct zcache_page *zcache_page_find(struct zcache_pool *pool,
+			struct cleancache_filekey *key, pgoff_t index)
+{
+	struct zcache_obj *obj = zcache_obj_find(pool, key);
+
+	return obj ? radix_tree_lookup(&obj->pages, index) : NULL;
+}
+
+/*
+ * Take 'zp' out of its file and the LRU, freeing the file if it was its
+ * last page. The data is left to the caller. Caller must hold zcache_lock.
+ */
+static void zcache_page_unlink(struct zcache_page *zp)
+{
+	struct zcache_obj *obj = zp->obj;
+
+	radix_tree_delete(&obj->pages, zp->index);
+	list_del(&zp->lru);
+	zcache_stored_pages--;
+
+	if (!--obj->nr_pages) {
+		hlist_del(&obj->hash);
+		kmem_cache_free(zcache_obj_cachep, obj);
+	}
+}
+
+/* Free 'zp' and its compressed data. Caller must hold zcache_lock. */
+static void zcache_data_free(struct zcache_page *zp)
+{
+	xv_free(zcache_xv, zp->page, zp->offset);
+	kmem_cache_free(zcache_page_cachep, zp);
+	zcache_pool_pages = xv_get_total_size_bytes(zcache_xv) >> PAGE_SHIFT;
+}
+
+/* Caller must hold zcache_lock. */
+static void zcache_page_free(struct zcache_page *zp)
+{
+	zcache_page_unlink(zp);
+	zcache_data_free(zp);
+}
+
+/* Caller must hold zcache_lock. */
+static void zcache_obj_free(struct zcache_obj *obj)
+{
+	struct zcache_page *zps[16];
+	unsigned long left = obj->nr_pages;
+	unsigned int i, nr;
+
+	/* the object goes with its last page: don't look at it after that */
+	while (left) {
+		nr = radix_tree_gang_lookup(&obj->pages, (void **)zps, 0,
+					min_t(unsigned long, left, ARRAY_SIZE(zps)));
+		if (WARN_ON(!nr))
+			break;
+		left -= nr;
+		for (i = 0; i < nr; i++)
+			zcache_page_free(zps[i]);
+	}
+}
+
+/* Drop the 'nr' oldest pages. Caller must hold zcache_lock. */
+static void zcache_evict(unsigned long nr)
+{
+	while (nr-- && !list_empty(&zcache_lru)) {
+		zcache_page_free(list_first_entry(&zcache_lru,
+					struct zcache_page, lru));
+		zcache_evicts++;
+	}
+}
+
+/*
+ * The pool may grow up to zcache_max_pct of RAM, and only while free memory
+ * stays above zcache_min_free_pct of RAM.
+ */
+static int zcache_low_on_memory(void)
+{
+	return global_page_state(NR_FREE_PAGES) <
+		totalram_pages / 100 * zcache_min_free_pct;
+}
+
+static int zcache_over_limit(void)
+{
+	return xv_get_used_size_bytes(zcache_xv) >> PAGE_SHIFT >=
+		totalram_pages / 100 * zcache_max_pct;
+}
+
+/*
+ * Get below zcache_max_pct of RAM by dropping the oldest cleancache pages;
+ * swap pages cannot be dropped. Caller must hold zcache_lock.
+ */
+static int zcache_make_room(void)
+{
+	while (zcache_over_limit()) {
+		if (list_empty(&zcache_lru))
+			return -ENOMEM;
+		zcache_evict(1);
+	}
+	return 0;
+}
+
+/*
+ * Compress 'page' into this CPU's buffer and return the buffer, or NULL if
+ * the page is not worth keeping. Interrupts must be disabled.
+ */
+static unsigned char *zcache_compress(struct page *page, size_t *clen)
+{
+	int ret;
+	unsigned char *src, *dst = __get_cpu_var(zcache_dstmem);
+
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, clen,
+				__get_cpu_var(zcache_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+
+	if (ret != LZO_E_OK || *clen > ZCACHE_MAX_CLEN)
+		return NULL;
+	return dst;
+}
+
+/*
+ * Copy 'clen' bytes of compressed data to the pool, in a zcache_page which
+ * is not linked anywhere yet. Caller must hold zcache_lock.
+ */
+static struct zcache_page *zcache_store(const unsigned char *src, size_t clen)
+{
+	u32 offset;
+	unsigned char *cmem;
+	struct page *zpage;
+	struct zcache_page *zp;
+
+	if (zcache_make_room())
+		return NULL;
+
+	if (xv_malloc(zcache_xv, clen, &zpage, &offset,
+			ZCACHE_GFP_MASK | __GFP_HIGHMEM))
+		return NULL;
+
+	zp = kmem_cache_alloc(zcache_page_cachep, ZCACHE_GFP_MASK);
+	if (!zp) {
+		xv_free(zcache_xv, zpage, offset);
+		return NULL;
+	}
+
+	cmem = kmap_atomic(zpage, KM_USER0) + offset;
+	memcpy(cmem, src, clen);
+	kunmap_atomic(cmem, KM_USER0);
+
+	INIT_LIST_HEAD(&zp->lru);
+	zp->obj = NULL;
+	zp->page = zpage;
+	zp->offset = offset;
+	zp->len = clen;
+	zcache_pool_pages = xv_get_total_size_bytes(zcache_xv) >> PAGE_SHIFT;
+
+	return zp;
+}
+
+static int zcache_load(struct zcache_page *zp, struct page *page)
+{
+	int ret;
+	size_t clen = PAGE_SIZE;
+	unsigned char *src, *dst;
+
+	src = kmap_atomic(zp->page, KM_USER0) + zp->offset;
+	dst = kmap_atomic(page, KM_USER1);
+	ret = lzo1x_decompress_safe(src, zp->len, dst, &clen);
+	kunmap_atomic(dst, KM_USER1);
+	kunmap_atomic(src, KM_USER0);
+
+	if (unlikely(ret != LZO_E_OK || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d\n", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void zcache_put_page(int pool_id, struct cleancache_filekey key,
+			pgoff_t index, struct page *page)
+{
+	size_t clen;
+	unsigned long flags;
+	unsigned char *dst;
+	struct zcache_pool *pool;
+	struct zcache_obj *obj;
+	struct zcache_page *zp;
+
+	local_irq_save(flags);
+	dst = zcache_compress(page, &clen);
+	spin_lock(&zcache_lock);
+
+	pool = zcache_pool(pool_id);
+	if (!pool)
+		goto out;
+
+	/* a stale copy must not outlive a failed put */
+	zp = zcache_page_find(pool, &key, index);
+	if (zp)
+		zcache_page_free(zp);
+
+	if (!dst || zcache_low_on_memory())
+		goto reject;
+
+	zp = zcache_store(dst, clen);
+	if (!zp)
+		goto reject;
+
+	obj = zcache_obj_find(pool, &key);
+	if (!obj) {
+		obj = kmem_cache_alloc(zcache_obj_cachep, ZCACHE_GFP_MASK);
+		if (!obj)
+			goto free_page;
+		obj->key = key;
+		INIT_RADIX_TREE(&obj->pages, ZCACHE_GFP_MASK);
+		obj->nr_pages = 0;
+		hlist_add_head(&obj->hash, zcache_obj_bucket(pool, &key));
+	}
+
+	if (radix_tree_insert(&obj->pages, index, zp)) {
+		if (!obj->nr_pages) {
+			hlist_del(&obj->hash);
+			kmem_cache_free(zcache_obj_cachep, obj);
+		}
+		goto free_page;
+	}
+	obj->nr_pages++;
+
+	zp->obj = obj;
+	zp->index = index;
+	list_add_tail(&zp->lru, &zcache_lru);
+
+	zcache_puts++;
+	zcache_stored_pages++;
+	goto out;
+
+free_page:
+	zcache_data_free(zp);
+reject:
+	zcache_put_rejects++;
+out:
+	spin_unlock(&zcache_lock);
+	local_irq_restore(flags);
+}
+
+/*
+ * Pages are handed out only once: after a hit, the page is in the page
+ * cache again and comes back through a put when it is evicted.
+ */
+static int zcache_get_page(int pool_id, struct cleancache_filekey key,
+			pgoff_t index, struct page *page)
+{
+	int ret;
+	unsigned long flags;
+	struct zcache_pool *pool;
+	struct zcache_page *zp = NULL;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	pool = zcache_pool(pool_id);
+	if (pool)
+		zp = zcache_page_find(pool, &key, index);
+	if (!zp) {
+		zcache_misses++;
+		spin_unlock_irqrestore(&zcache_lock, flags);
+		return -1;
+	}
+	zcache_page_unlink(zp);
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	ret = zcache_load(zp, page);
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	zcache_data_free(zp);
+	if (!ret)
+		zcache_hits++;
+	else
+		zcache_misses++;
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	return ret;
+}
+
+static void zcache_flush_page(int pool_id, struct cleancache_filekey key,
+			pgoff_t index)
+{
+	unsigned long flags;
+	struct zcache_pool *pool;
+	struct zcache_page *zp;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	pool = zcache_pool(pool_id);
+	if (pool) {
+		zp = zcache_page_find(pool, &key, index);
+		if (zp) {
+			zcache_page_free(zp);
+			zcache_flushes++;
+		}
+	}
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static void zcache_flush_inode(int pool_id, struct cleancache_filekey key)
+{
+	unsigned long flags;
+	struct zcache_pool *pool;
+	struct zcache_obj *obj;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	pool = zcache_pool(pool_id);
+	if (pool) {
+		obj = zcache_obj_find(pool, &key);
+		if (obj) {
+			zcache_flushes += obj->nr_pages;
+			zcache_obj_free(obj);
+		}
+	}
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static void zcache_flush_fs(int pool_id)
+{
+	int i;
+	unsigned long flags;
+	struct zcache_pool *pool;
+	struct zcache_obj *obj;
+	struct hlist_node *pos, *n;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	pool = zcache_pool(pool_id);
+	if (pool) {
+		for (i = 0; i < ARRAY_SIZE(pool->objs); i++)
+			hlist_for_each_entry_safe(obj, pos, n,
+						&pool->objs[i], hash)
+				zcache_obj_free(obj);
+		zcache_pools[pool_id] = NULL;
+	}
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	kfree(pool);
+}
+
+static int zcache_init_fs(size_t pagesize)
+{
+	int i;
+	unsigned long flags;
+	struct zcache_pool *pool;
+
+	if (pagesize != PAGE_SIZE)
+		return -1;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return -1;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	for (i = 0; i < ZCACHE_MAX_POOLS; i++) {
+		if (!zcache_pools[i]) {
+			zcache_pools[i] = pool;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	if (i == ZCACHE_MAX_POOLS) {
+		pr_warning("Too many filesystems, not caching this one\n");
+		kfree(pool);
+		return -1;
+	}
+
+	return i;
+}
+
+/* Pages of a shared filesystem are only cached for this kernel */
+static int zcache_init_shared_fs(char *uuid, size_t pagesize)
+{
+	return zcache_init_fs(pagesize);
+}
+
+static struct cleancache_ops zcache_ops = {
+	.init_fs = zcache_init_fs,
+	.init_shared_fs = zcache_init_shared_fs,
+	.get_page = zcache_get_page,
+	.put_page = zcache_put_page,
+	.flush_page = zcache_flush_page,
+	.flush_inode = zcache_flush_inode,
+	.flush_fs = zcache_flush_fs,
+};
+
+#ifdef CONFIG_FRONTSWAP
+/*
+ * Swap pages handed over by frontswap, per swap area and indexed by swap
+ * offset. Unlike cleancache pages they must be kept until frontswap
+ * flushes them, so they are not on the LRU: once the pool is at its limit
+ * and no cleancache page is left to drop, puts are refused and the pages
+ * go to the swap device. Protected by zcache_lock.
+ */
+static struct radix_tree_root zcache_swap_trees[MAX_SWAPFILES];
+
+static u64 zcache_swap_pages;
+static u64 zcache_swap_rejects;
+
+/* Caller must hold zcache_lock. */
+static void zcache_swap_free(unsigned type, pgoff_t offset)
+{
+	struct zcache_page *zp;
+
+	zp = radix_tree_delete(&zcache_swap_trees[type], offset);
+	if (zp) {
+		zcache_data_free(zp);
+		zcache_swap_pages--;
+	}
+}
+
+static void zcache_swap_init(unsigned type)
+{
+}
+
+static int zcache_swap_put_page(unsigned type, pgoff_t offset,
+			struct page *page)
+{
+	int ret = -1;
+	size_t clen;
+	unsigned long flags;
+	unsigned char *dst;
+	struct zcache_page *zp;
+
+	local_irq_save(flags);
+	dst = zcache_compress(page, &clen);
+	spin_lock(&zcache_lock);
+
+	/* the page was dirtied again since it was last put */
+	zcache_swap_free(type, offset);
+
+	zp = dst ? zcache_store(dst, clen) : NULL;
+	if (!zp)
+		goto out;
+
+	if (radix_tree_insert(&zcache_swap_trees[type], offset, zp)) {
+		zcache_data_free(zp);
+		goto out;
+	}
+	zp->index = offset;
+	zcache_swap_pages++;
+	ret = 0;
+out:
+	if (ret)
+		zcache_swap_rejects++;
+	spin_unlock(&zcache_lock);
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+/* The page stays here until its swap slot is freed */
+static int zcache_swap_get_page(unsigned type, pgoff_t offset,
+			struct page *page)
+{
+	int ret = -1;
+	unsigned long flags;
+	struct zcache_page *zp;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	zp = radix_tree_lookup(&zcache_swap_trees[type], offset);
+	if (zp)
+		ret = zcache_load(zp, page);
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	return ret;
+}
+
+static void zcache_swap_flush_page(unsigned type, pgoff_t offset)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	zcache_swap_free(type, offset);
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static void zcache_swap_flush_area(unsigned type)
+{
+	struct zcache_page *zps[16];
+	unsigned long flags;
+	unsigned int i, nr;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	do {
+		nr = radix_tree_gang_lookup(&zcache_swap_trees[type],
+					(void **)zps, 0, ARRAY_SIZE(zps));
+		for (i = 0; i < nr; i++)
+			zcache_swap_free(type, zps[i]->index);
+	} while (nr == ARRAY_SIZE(zps));
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static struct frontswap_ops zcache_swap_ops = {
+	.init = zcache_swap_init,
+	.put_page = zcache_swap_put_page,
+	.get_page = zcache_swap_get_page,
+	.flush_page = zcache_swap_flush_page,
+	.flush_area = zcache_swap_flush_area,
+};
+
+static void zcache_frontswap_init(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_SWAPFILES; i++)
+		INIT_RADIX_TREE(&zcache_swap_trees[i], ZCACHE_GFP_MASK);
+	frontswap_register_ops(&zcache_swap_ops);
+}
+#else
+static void zcache_frontswap_init(void)
+{
+}
+#endif /* CONFIG_FRONTSWAP */
+
+static int zcache_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	if (nr_to_scan > 0)
+		zcache_evict(nr_to_scan);
+	ret = zcache_stored_pages;
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	return ret;
+}
+
+static struct shrinker zcache_shrinker = {
+	.shrink = zcache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static void zcache_debugfs_init(void)
+{
+	zcache_debugfs_dir = debugfs_create_dir("zcache", NULL);
+	if (!zcache_debugfs_dir)
+		return;
+
+	debugfs_create_u64("hits", S_IRUGO, zcache_debugfs_dir,
+				&zcache_hits);
+	debugfs_create_u64("misses", S_IRUGO, zcache_debugfs_dir,
+				&zcache_misses);
+	debugfs_create_u64("puts", S_IRUGO, zcache_debugfs_dir,
+				&zcache_puts);
+	debugfs_create_u64("put_rejects", S_IRUGO, zcache_debugfs_dir,
+				&zcache_put_rejects);
+	debugfs_create_u64("evicts", S_IRUGO, zcache_debugfs_dir,
+				&zcache_evicts);
+	debugfs_create_u64("flushes", S_IRUGO, zcache_debugfs_dir,
+				&zcache_flushes);
+	debugfs_create_u64("stored_pages", S_IRUGO, zcache_debugfs_dir,
+				&zcache_stored_pages);
+	debugfs_create_u64("pool_pages", S_IRUGO, zcache_debugfs_dir,
+				&zcache_pool_pages);
+#ifdef CONFIG_FRONTSWAP
+	debugfs_create_u64("swap_pages", S_IRUGO, zcache_debugfs_dir,
+				&zcache_swap_pages);
+	debugfs_create_u64("swap_rejects", S_IRUGO, zcache_debugfs_dir,
+				&zcache_swap_rejects);
+#endif
+}
+
+static int __init zcache_init(void)
+{
+	int cpu;
+
+	zcache_xv = xv_create_pool();
+	if (!zcache_xv)
+		goto fail;
+
+	zcache_obj_cachep = KMEM_CACHE(zcache_obj, 0);
+	zcache_page_cachep = KMEM_CACHE(zcache_page, 0);
+	if (!zcache_obj_cachep || !zcache_page_cachep)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		per_cpu(zcache_dstmem, cpu) =
+			kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+		per_cpu(zcache_wrkmem, cpu) = vmalloc(LZO1X_MEM_COMPRESS);
+		if (!per_cpu(zcache_dstmem, cpu) ||
+		    !per_cpu(zcache_wrkmem, cpu))
+			goto fail;
+	}
+
+	register_shrinker(&zcache_shrinker);
+	zcache_debugfs_init();
+	cleancache_register_ops(&zcache_ops);
+	zcache_frontswap_init();
+
+	pr_info("Caching clean pages in up to %u%% of RAM\n", zcache_max_pct);
+	return 0;
+
+fail:
+	/* cleancache stays disabled */
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zcache_dstmem, cpu));
+		vfree(per_cpu(zcache_wrkmem, cpu));
+	}
+	if (zcache_page_cachep)
+		kmem_cache_destroy(zcache_page_cachep);
+	if (zcache_obj_cachep)
+		kmem_cache_destroy(zcache_obj_cachep);
+	if (zcache_xv)
+		xv_destroy_pool(zcache_xv);
+	pr_err("Error allocating memory, not enabled\n");
+	return -ENOMEM;
+}
+
+module_param_named(max_pct, zcache_max_pct, uint, 0644);
+MODULE_PARM_DESC(max_pct, "Maximum size of the cache, in % of RAM");
+
+module_param_named(min_free_pct, zcache_min_free_pct, uint, 0644);
+MODULE_PARM_DESC(min_free_pct,
+	"Free memory, in % of RAM, below which no pages are cached");
+
+module_init(zcache_init);
@@ -327,6 +327,25 @@ static inline void task_context_switch_counts(struct seq_file *m,
 			p->nivcsw);
 }
 
+/* Summed over the live threads of the process */
+static void task_refault_counts(struct seq_file *m, struct task_struct *p)
+{
+	unsigned long refaults = 0, refaults_active = 0;
+	struct task_struct *t = p;
+
+	rcu_read_lock();
+	do {
+		refaults += t->refaults;
+		refaults_active += t->refaults_active;
+	} while_each_thread(p, t);
+	rcu_read_unlock();
+
+	seq_printf(m,	"workingset_refault:\t%lu\n"
+			"workingset_activate:\t%lu\n",
+			refaults,
+			refaults_active);
+}
+
 static void task_cpus_allowed(struct seq_file *m, struct task_struct *task)
 {
 	seq_printf(m, "Cpus_allowed:\t");
@@ -357,6 +376,7 @@ int proc_pid_status(struct seq_file *m, struct pid_namespace *ns,
 	task_show_regs(m, task);
 #endif
 	task_context_switch_counts(m, task);
+	task_refault_counts(m, task);
 	return 0;
 }
 
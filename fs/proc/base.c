@@ -1049,6 +1049,12 @@ static ssize_t oom_adjust_write(struct file *file, const char __user *buf,
 	task->signal->oom_adj = oom_adjust;
 
 	unlock_task_sighand(task, &flags);
+	oom_adj_update_task(task);
+
+	task_lock(task);
+	if (task->mm)
+		task->mm->oom_adj = oom_adjust;
+	task_unlock(task);
 	put_task_struct(task);
 
 	return count;
@@ -27,6 +27,15 @@
 #define ASHMEM_IS_UNPINNED	0
 #define ASHMEM_IS_PINNED	1
 
+/*
+ * Values for ASHMEM_SET_PURGE_PRIORITY: How costly is it to regenerate the
+ * contents of unpinned pages? Cheap ones are purged first.
+ */
+#define ASHMEM_PURGE_PRIORITY_CHEAP	0
+#define ASHMEM_PURGE_PRIORITY_NORMAL	1
+#define ASHMEM_PURGE_PRIORITY_EXPENSIVE	2
+#define ASHMEM_PURGE_PRIORITY_NR	3
+
 struct ashmem_pin {
 	__u32 offset;	/* offset into region, in bytes, page-aligned */
 	__u32 len;	/* length forward from offset, in bytes, page-aligned */
@@ -47,6 +56,8 @@ struct ashmem_pin {
 #define ASHMEM_CACHE_FLUSH_RANGE	_IO(__ASHMEMIOC, 11)
 #define ASHMEM_CACHE_CLEAN_RANGE	_IO(__ASHMEMIOC, 12)
 #define ASHMEM_CACHE_INV_RANGE   _IO(__ASHMEMIOC, 13)
+#define ASHMEM_SET_PURGE_PRIORITY	_IOW(__ASHMEMIOC, 14, unsigned int)
+#define ASHMEM_GET_PURGE_PRIORITY	_IO(__ASHMEMIOC, 15)
 
 int get_ashmem_file(int fd, struct file **filp, struct file **vm_file,
 			unsigned long *len);
@@ -0,0 +1,103 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+
+/*
+ * frontswap lets a backend, typically a compressed RAM store, take swap
+ * pages synchronously in swap_writepage() before a bio is built for them.
+ * Unlike cleancache, a page accepted by put_page must be returned by
+ * get_page until it is flushed: the swap device never sees it.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned);
+	int (*put_page)(unsigned, pgoff_t, struct page *);
+	int (*get_page)(unsigned, pgoff_t, struct page *);
+	void (*flush_page)(unsigned, pgoff_t);
+	void (*flush_area)(unsigned);
+};
+
+extern struct frontswap_ops
+	frontswap_register_ops(struct frontswap_ops *ops);
+extern void __frontswap_init(struct swap_info_struct *, unsigned long *);
+extern int __frontswap_put_page(struct page *);
+extern int __frontswap_get_page(struct page *);
+extern void __frontswap_flush_page(struct swap_info_struct *, pgoff_t);
+extern unsigned long *__frontswap_flush_area(struct swap_info_struct *);
+extern int frontswap_enabled;
+
+#ifndef CONFIG_FRONTSWAP
+#define frontswap_enabled (0)
+#endif
+
+/*
+ * As with cleancache, these reduce to nothing when CONFIG_FRONTSWAP is
+ * off, and to a global variable check while no backend is registered.
+ */
+
+/* One bit per swap slot, for swapon to hand to frontswap_init() */
+static inline unsigned long *frontswap_alloc_map(unsigned long maxpages)
+{
+	unsigned long *map = NULL;
+	size_t size = BITS_TO_LONGS(maxpages) * sizeof(long);
+
+	if (frontswap_enabled) {
+		map = vmalloc(size);
+		if (map)
+			memset(map, 0, size);
+	}
+	return map;
+}
+
+/* Called by swapon with swap_lock held; the area takes over 'map' */
+static inline void frontswap_init(struct swap_info_struct *sis,
+				unsigned long *map)
+{
+	if (frontswap_enabled && map)
+		__frontswap_init(sis, map);
+}
+
+/* Returns 0 if the backend took the page; the page must be locked */
+static inline int frontswap_put_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_put_page(page);
+	return ret;
+}
+
+/* Returns 0 if the page was filled from the backend */
+static inline int frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_get_page(page);
+	return ret;
+}
+
+/* Called with swap_lock held when a swap slot is freed */
+static inline void frontswap_flush_page(struct swap_info_struct *sis,
+				pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_flush_page(sis, offset);
+}
+
+/*
+ * Called by swapoff with swap_lock held, once the area is empty. Returns
+ * the map for the caller to vfree() after dropping the lock.
+ */
+static inline unsigned long *frontswap_flush_area(struct swap_info_struct *sis)
+{
+	unsigned long *map = NULL;
+
+	if (frontswap_enabled)
+		map = __frontswap_flush_area(sis);
+	return map;
+}
+
+#endif /* _LINUX_FRONTSWAP_H */
@@ -55,6 +55,14 @@ extern void mem_cgroup_cancel_charge_swapin(struct mem_cgroup *ptr);
 
 extern int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 					gfp_t gfp_mask);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_LAZY_CACHE
+extern void mem_cgroup_charge_mapped(struct page *page, struct mm_struct *mm);
+#else
+static inline void mem_cgroup_charge_mapped(struct page *page,
+					struct mm_struct *mm)
+{
+}
+#endif
 extern void mem_cgroup_add_lru_list(struct page *page, enum lru_list lru);
 extern void mem_cgroup_del_lru_list(struct page *page, enum lru_list lru);
 extern void mem_cgroup_rotate_lru_list(struct page *page, enum lru_list lru);
@@ -127,6 +135,9 @@ static inline bool mem_cgroup_disabled(void)
 }
 
 void mem_cgroup_update_file_mapped(struct page *page, int val);
+void mem_cgroup_workingset_refault(struct page *page, bool activate);
+void mem_cgroup_vmpressure(struct mem_cgroup *mem, gfp_t gfp_mask,
+			   unsigned long scanned, unsigned long reclaimed);
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask, int nid,
 						int zid);
@@ -145,6 +156,11 @@ static inline int mem_cgroup_cache_charge(struct page *page,
 	return 0;
 }
 
+static inline void mem_cgroup_charge_mapped(struct page *page,
+					struct mm_struct *mm)
+{
+}
+
 static inline int mem_cgroup_try_charge_swapin(struct mm_struct *mm,
 		struct page *page, gfp_t gfp_mask, struct mem_cgroup **ptr)
 {
@@ -302,6 +318,17 @@ static inline void mem_cgroup_update_file_mapped(struct page *page,
 {
 }
 
+static inline void mem_cgroup_workingset_refault(struct page *page,
+							bool activate)
+{
+}
+
+static inline void mem_cgroup_vmpressure(struct mem_cgroup *mem,
+			gfp_t gfp_mask, unsigned long scanned,
+			unsigned long reclaimed)
+{
+}
+
 static inline
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 					    gfp_t gfp_mask, int nid, int zid)
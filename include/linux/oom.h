@@ -11,9 +11,12 @@
 
 #include <linux/types.h>
 #include <linux/nodemask.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -43,5 +46,43 @@ static inline void oom_killer_enable(void)
 {
 	oom_killer_disabled = false;
 }
+
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+/*
+ * Processes hashed by oom_adj, from OOM_DISABLE to OOM_ADJUST_MAX, so that
+ * the low memory killer finds its victims without walking the task list.
+ * Thread group leaders are on the list of their current oom_adj for as
+ * long as they are on the task list. Protected by oom_adj_lock, which is
+ * taken with interrupts disabled.
+ */
+#define OOM_ADJ_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define oom_adj_bucket(adj)	(&oom_adj_buckets[(adj) - OOM_DISABLE])
+
+extern spinlock_t oom_adj_lock;
+extern struct hlist_head oom_adj_buckets[OOM_ADJ_BUCKETS];
+
+extern void oom_adj_add_task(struct task_struct *p);
+extern void oom_adj_del_task(struct task_struct *p);
+extern void oom_adj_replace_task(struct task_struct *old,
+				 struct task_struct *new);
+extern void oom_adj_update_task(struct task_struct *p);
+#else
+static inline void oom_adj_add_task(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_del_task(struct task_struct *p)
+{
+}
+
+static inline void oom_adj_replace_task(struct task_struct *old,
+					struct task_struct *new)
+{
+}
+
+static inline void oom_adj_update_task(struct task_struct *p)
+{
+}
+#endif
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
@@ -1227,6 +1227,9 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct hlist_node oom_adj_node;
+#endif
 	struct plist_node pushable_tasks;
 
 	struct mm_struct *mm, *active_mm;
@@ -1296,6 +1299,8 @@ struct task_struct {
 	struct timespec real_start_time;	/* boot based time */
 /* mm fault and swap info: this can arguably be seen as either mm-specific or thread-specific */
 	unsigned long min_flt, maj_flt;
+/* page cache refaults, see mm/workingset.c */
+	unsigned long refaults, refaults_active;
 
 	struct task_cputime cputime_expires;
 	struct list_head cpu_timers[3];
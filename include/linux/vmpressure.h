@@ -0,0 +1,19 @@
+#ifndef _LINUX_VMPRESSURE_H
+#define _LINUX_VMPRESSURE_H
+
+#include <linux/types.h>
+#include <linux/gfp.h>
+
+struct notifier_block;
+
+/*
+ * Reclaim efficiency as seen by global page reclaim is reported to the
+ * vmpressure notifier chain as a value from 0 (everything scanned was
+ * reclaimed) to 100 (nothing was).
+ */
+extern void vmpressure(gfp_t gfp_mask, unsigned long scanned,
+		       unsigned long reclaimed);
+extern int vmpressure_register_notifier(struct notifier_block *nb);
+extern int vmpressure_unregister_notifier(struct notifier_block *nb);
+
+#endif /* _LINUX_VMPRESSURE_H */
@@ -17,6 +17,8 @@
 */
 
 #include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
@@ -27,7 +29,12 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
 #include <linux/ashmem.h>
 
 #ifdef CONFIG_QCT_ASHMEM_CACHE_FLUSH
@@ -38,13 +45,28 @@
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
 
+/*
+ * ashmem_owner - purge accounting for the process that created areas
+ * Lifecycle: From the first open() of the process until its last release()
+ * Locking: Protected by `ashmem_owner_lock'
+ */
+struct ashmem_owner {
+	struct list_head list;		/* entry in ashmem_owner_list */
+	pid_t tgid;
+	char comm[TASK_COMM_LEN];
+	unsigned int areas;		/* areas created and not released */
+	u64 purged_bytes;		/* unpinned bytes purged by the shrinker */
+	u64 refaults;			/* pins that found the range purged */
+};
+
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
+	struct mutex mutex;		/* protects the area and its ranges */
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
 	struct list_head unpinned_list;	/* list of all ashmem areas */
 	struct file *file;		/* the shmem-based backing file */
@@ -52,12 +74,14 @@ struct ashmem_area {
 	unsigned long vm_start;		/* Start address of vm_area
 					 * which maps this ashmem */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	unsigned int purge_priority;	/* ASHMEM_PURGE_PRIORITY_* */
+	struct ashmem_owner *owner;	/* process that created it */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex'; `lru' also by `ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
@@ -65,21 +89,50 @@ struct ashmem_range {
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
-	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED,
+					 * or ASHMEM_COMPRESSED */
+#ifdef CONFIG_ASHMEM_COMPRESS
+	struct ashmem_zpage **zpages;	/* compressed pages, if COMPRESSED */
+	size_t zbytes;			/* size of zpages' data */
+#endif
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
-static LIST_HEAD(ashmem_lru_list);
+/* Internal range state: pages are held compressed, restored on pin */
+#define ASHMEM_COMPRESSED	2
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/*
+ * LRU lists of unpinned pages, one per purge priority, protected by
+ * ashmem_lru_lock
+ */
+static struct list_head ashmem_lru_list[ASHMEM_PURGE_PRIORITY_NR] = {
+	LIST_HEAD_INIT(ashmem_lru_list[0]),
+	LIST_HEAD_INIT(ashmem_lru_list[1]),
+	LIST_HEAD_INIT(ashmem_lru_list[2]),
+};
+
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * LRU list of compressed ranges and the size of their data, protected by
+ * ashmem_lru_lock
+ */
+static LIST_HEAD(ashmem_zlru_list);
+static unsigned long ashmem_zpool_bytes;
+
+/*
+ * ashmem_lru_lock - protects the LRU list, so that the shrinker can scan it
+ * without taking the mutex of every area that pin and unpin work under.
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock
+ *                asma->mutex -> i_mutex -> i_alloc_sem
+ * The shrinker only ever trylocks asma->mutex under ashmem_lru_lock.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/* Processes owning areas, protected by ashmem_owner_lock */
+static LIST_HEAD(ashmem_owner_list);
+static DEFINE_SPINLOCK(ashmem_owner_lock);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -110,16 +163,319 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
-	list_add_tail(&range->lru, &ashmem_lru_list);
+	spin_lock(&ashmem_lru_lock);
+	list_add_tail(&range->lru,
+		      &ashmem_lru_list[range->asma->purge_priority]);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
-static inline void lru_del(struct ashmem_range *range)
+/* Caller must hold ashmem_lru_lock. */
+static inline void __lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+static inline void lru_del(struct ashmem_range *range)
+{
+	spin_lock(&ashmem_lru_lock);
+	__lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
+/*
+ * lru_trylock_area - lock the area of the first range on 'lru' whose area
+ * is not busy, and return it
+ *
+ * Caller must hold ashmem_lru_lock.
+ */
+static struct ashmem_area *lru_trylock_area(struct list_head *lru)
+{
+	struct ashmem_range *range;
+
+	list_for_each_entry(range, lru, lru) {
+		if (mutex_trylock(&range->asma->mutex))
+			return range->asma;
+	}
+
+	return NULL;
+}
+
+#ifdef CONFIG_ASHMEM_COMPRESS
+/*
+ * ashmem_zpage - an unpinned page kept compressed instead of being purged
+ */
+struct ashmem_zpage {
+	size_t len;
+	unsigned char data[0];
+};
+
+static int ashmem_compress = 1;
+module_param_named(compress, ashmem_compress, bool, S_IRUGO | S_IWUSR);
+
+/* Beyond this, the oldest compressed ranges are purged first */
+static unsigned int ashmem_zpool_max_kb = 16384;
+module_param_named(zpool_max_kb, ashmem_zpool_max_kb, uint,
+		   S_IRUGO | S_IWUSR);
+
+/* Compression buffers, protected by ashmem_zbuf_mutex */
+static DEFINE_MUTEX(ashmem_zbuf_mutex);
+static void *ashmem_zwrkmem;
+static unsigned char *ashmem_zbuf;
+
+static inline int ashmem_zpool_full(void)
+{
+	return ashmem_zpool_bytes >= (unsigned long)ashmem_zpool_max_kb << 10;
+}
+
+static inline int ashmem_should_compress(void)
+{
+	return ashmem_compress && !ashmem_zpool_full();
+}
+
+static inline unsigned long ashmem_zpool_pages(void)
+{
+	return DIV_ROUND_UP(ashmem_zpool_bytes, PAGE_SIZE);
+}
+
+/*
+ * ashmem_zlru_trylock_area - lock the area of the oldest compressed range
+ *
+ * Caller must hold ashmem_lru_lock.
+ */
+static inline struct ashmem_area *ashmem_zlru_trylock_area(void)
+{
+	return lru_trylock_area(&ashmem_zlru_list);
+}
+
+/*
+ * ashmem_compress_range - compress the resident pages of 'range', which is
+ * off the LRU, and drop them from its file. Holes, pages out on swap and
+ * pages that do not compress well stay in the file. Returns zero if the
+ * range is now COMPRESSED.
+ *
+ * Caller must hold asma->mutex.
+ */
+static int ashmem_compress_range(struct ashmem_range *range)
+{
+	struct address_space *mapping = range->asma->file->f_mapping;
+	struct ashmem_zpage **zpages, *zpage;
+	size_t i, run, len, n = range_size(range), zbytes = 0;
+	struct page *page;
+	void *src;
+	int ret;
+
+	/* we are in reclaim; do not recurse into it */
+	zpages = kcalloc(n, sizeof(*zpages), GFP_NOWAIT | __GFP_NOWARN);
+	if (unlikely(!zpages))
+		return -ENOMEM;
+
+	mutex_lock(&ashmem_zbuf_mutex);
+	for (i = 0; i < n; i++) {
+		page = find_get_page(mapping, range->pgstart + i);
+		if (!page)
+			continue;
+
+		src = kmap_atomic(page, KM_USER0);
+		ret = lzo1x_1_compress(src, PAGE_SIZE, ashmem_zbuf, &len,
+				       ashmem_zwrkmem);
+		kunmap_atomic(src, KM_USER0);
+		page_cache_release(page);
+
+		if (ret != LZO_E_OK || len > PAGE_SIZE / 2)
+			continue;
+
+		zpage = kmalloc(sizeof(*zpage) + len,
+				GFP_NOWAIT | __GFP_NOWARN);
+		if (unlikely(!zpage))
+			break;
+		zpage->len = len;
+		memcpy(zpage->data, ashmem_zbuf, len);
+		zpages[i] = zpage;
+		zbytes += len;
+	}
+	mutex_unlock(&ashmem_zbuf_mutex);
+
+	if (!zbytes) {
+		kfree(zpages);
+		return -EINVAL;
+	}
+
+	/* drop what we hold compressed, a run of pages at a time */
+	for (i = 0; i < n; i = run + 1) {
+		for (run = i; run < n && zpages[run]; run++)
+			;
+		if (run > i)
+			vmtruncate_range(mapping->host,
+					 (range->pgstart + i) * PAGE_SIZE,
+					 (range->pgstart + run) * PAGE_SIZE - 1);
+	}
+
+	range->zpages = zpages;
+	range->zbytes = zbytes;
+
+	spin_lock(&ashmem_lru_lock);
+	range->purged = ASHMEM_COMPRESSED;
+	list_add_tail(&range->lru, &ashmem_zlru_list);
+	ashmem_zpool_bytes += zbytes;
+	spin_unlock(&ashmem_lru_lock);
+
+	return 0;
+}
+
+/*
+ * ashmem_zfree_range - free the compressed pages of 'range' and take it
+ * off the compressed LRU. The caller sets its new state.
+ *
+ * Caller must hold asma->mutex.
+ */
+static void ashmem_zfree_range(struct ashmem_range *range)
+{
+	size_t i;
+
+	spin_lock(&ashmem_lru_lock);
+	list_del(&range->lru);
+	ashmem_zpool_bytes -= range->zbytes;
+	spin_unlock(&ashmem_lru_lock);
+
+	for (i = 0; i < range_size(range); i++)
+		kfree(range->zpages[i]);
+	kfree(range->zpages);
+	range->zpages = NULL;
+	range->zbytes = 0;
+}
+
+/*
+ * ashmem_restore_range - write the compressed pages of 'range' back to its
+ * file and put it back on the LRU. If that fails, the range is purged.
+ *
+ * Caller must hold asma->mutex.
+ */
+static void ashmem_restore_range(struct ashmem_range *range)
+{
+	struct file *file = range->asma->file;
+	struct ashmem_zpage *zpage;
+	struct page *page;
+	size_t i, len;
+	void *dst;
+	int ret = LZO_E_OK;
+
+	for (i = 0; i < range_size(range) && ret == LZO_E_OK; i++) {
+		zpage = range->zpages[i];
+		if (!zpage)
+			continue;
+
+		page = read_mapping_page(file->f_mapping,
+					 range->pgstart + i, file);
+		if (IS_ERR(page)) {
+			ret = LZO_E_ERROR;
+			break;
+		}
+
+		len = PAGE_SIZE;
+		dst = kmap_atomic(page, KM_USER0);
+		ret = lzo1x_decompress_safe(zpage->data, zpage->len, dst, &len);
+		kunmap_atomic(dst, KM_USER0);
+		if (ret == LZO_E_OK && len != PAGE_SIZE)
+			ret = LZO_E_ERROR;
+
+		flush_dcache_page(page);
+		set_page_dirty(page);
+		page_cache_release(page);
+	}
+
+	ashmem_zfree_range(range);
+
+	if (ret != LZO_E_OK) {
+		vmtruncate_range(file->f_dentry->d_inode,
+				 range->pgstart * PAGE_SIZE,
+				 (range->pgend + 1) * PAGE_SIZE - 1);
+		range->purged = ASHMEM_WAS_PURGED;
+		return;
+	}
+
+	range->purged = ASHMEM_NOT_PURGED;
+	lru_add(range);
+}
+
+/*
+ * ashmem_discard_area - purge compressed ranges of 'asma', until the data of
+ * 'nr_to_scan' pages is freed. Returns the number of pages freed.
+ *
+ * Caller must hold asma->mutex.
+ */
+static int ashmem_discard_area(struct ashmem_area *asma, int nr_to_scan)
+{
+	struct inode *inode = asma->file->f_dentry->d_inode;
+	struct ashmem_range *range;
+	int freed = 0, purged = 0;
+
+	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+		if (range->purged != ASHMEM_COMPRESSED)
+			continue;
+
+		freed += DIV_ROUND_UP(range->zbytes, PAGE_SIZE);
+		ashmem_zfree_range(range);
+		range->purged = ASHMEM_WAS_PURGED;
+
+		/* pages left in the file go as well */
+		vmtruncate_range(inode, range->pgstart * PAGE_SIZE,
+				 (range->pgend + 1) * PAGE_SIZE - 1);
+		purged += range_size(range);
+
+		if (freed >= nr_to_scan)
+			break;
+	}
+
+	spin_lock(&ashmem_owner_lock);
+	asma->owner->purged_bytes += (u64)purged * PAGE_SIZE;
+	spin_unlock(&ashmem_owner_lock);
+
+	return freed;
+}
+
+static int __init ashmem_compress_init(void)
+{
+	ashmem_zwrkmem = vmalloc(LZO1X_MEM_COMPRESS);
+	ashmem_zbuf = kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+	if (unlikely(!ashmem_zwrkmem || !ashmem_zbuf)) {
+		vfree(ashmem_zwrkmem);
+		kfree(ashmem_zbuf);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void ashmem_compress_exit(void)
+{
+	vfree(ashmem_zwrkmem);
+	kfree(ashmem_zbuf);
+}
+#else
+static inline int ashmem_should_compress(void) { return 0; }
+static inline int ashmem_zpool_full(void) { return 0; }
+static inline unsigned long ashmem_zpool_pages(void) { return 0; }
+static inline struct ashmem_area *ashmem_zlru_trylock_area(void)
+{
+	return NULL;
+}
+static inline int ashmem_compress_range(struct ashmem_range *range)
+{
+	return -EINVAL;
+}
+static inline void ashmem_zfree_range(struct ashmem_range *range) { }
+static inline void ashmem_restore_range(struct ashmem_range *range) { }
+static inline int ashmem_discard_area(struct ashmem_area *asma,
+				      int nr_to_scan)
+{
+	return 0;
+}
+static inline int ashmem_compress_init(void) { return 0; }
+static inline void ashmem_compress_exit(void) { }
+#endif /* CONFIG_ASHMEM_COMPRESS */
+
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
@@ -129,7 +485,7 @@ static inline void lru_del(struct ashmem_range *range)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int range_alloc(struct ashmem_area *asma,
 		       struct ashmem_range *prev_range, unsigned int purged,
@@ -159,24 +515,74 @@ static void range_del(struct ashmem_range *range)
 	list_del(&range->unpinned);
 	if (range_on_lru(range))
 		lru_del(range);
+	else if (range->purged == ASHMEM_COMPRESSED)
+		ashmem_zfree_range(range);
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
 {
 	size_t pre = range_size(range);
 
-	range->pgstart = start;
-	range->pgend = end;
-
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
+		range->pgstart = start;
+		range->pgend = end;
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	} else {
+		range->pgstart = start;
+		range->pgend = end;
+	}
+}
+
+/*
+ * owner_get - account a new area to the current process
+ */
+static struct ashmem_owner *owner_get(void)
+{
+	struct ashmem_owner *owner, *new;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (unlikely(!new))
+		return NULL;
+
+	spin_lock(&ashmem_owner_lock);
+	list_for_each_entry(owner, &ashmem_owner_list, list) {
+		if (owner->tgid == current->tgid) {
+			owner->areas++;
+			spin_unlock(&ashmem_owner_lock);
+			kfree(new);
+			return owner;
+		}
+	}
+
+	new->tgid = current->tgid;
+	get_task_comm(new->comm, current->group_leader);
+	new->areas = 1;
+	list_add_tail(&new->list, &ashmem_owner_list);
+	spin_unlock(&ashmem_owner_lock);
+
+	return new;
+}
+
+static void owner_put(struct ashmem_owner *owner)
+{
+	spin_lock(&ashmem_owner_lock);
+	if (--owner->areas) {
+		spin_unlock(&ashmem_owner_lock);
+		return;
+	}
+	list_del(&owner->list);
+	spin_unlock(&ashmem_owner_lock);
+
+	kfree(owner);
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -192,9 +598,17 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
+	asma->owner = owner_get();
+	if (unlikely(!asma->owner)) {
+		kmem_cache_free(ashmem_area_cachep, asma);
+		return -ENOMEM;
+	}
+
+	mutex_init(&asma->mutex);
 	INIT_LIST_HEAD(&asma->unpinned_list);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
+	asma->purge_priority = ASHMEM_PURGE_PRIORITY_NORMAL;
 	file->private_data = asma;
 
 	return 0;
@@ -205,13 +619,14 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
+	owner_put(asma->owner);
 	kmem_cache_free(ashmem_area_cachep, asma);
 
 	return 0;
@@ -223,7 +638,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -244,7 +659,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -253,7 +668,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -274,7 +689,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -291,7 +706,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -335,10 +750,61 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	asma->vm_start = vma->vm_start;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * ashmem_purge_area - purge up to 'nr_to_scan' unpinned pages of 'asma'
+ *
+ * All of them are taken off the LRU in one go, then compressed if 'compress'
+ * is set and that works, or truncated. Returns the number of pages taken off
+ * the LRU.
+ *
+ * Caller must hold asma->mutex.
+ */
+static int ashmem_purge_area(struct ashmem_area *asma, int nr_to_scan,
+			     int compress)
+{
+	struct inode *inode = asma->file->f_dentry->d_inode;
+	struct ashmem_range *range, *next;
+	LIST_HEAD(batch);
+	int scanned = 0, purged = 0;
+
+	spin_lock(&ashmem_lru_lock);
+	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+		if (!range_on_lru(range))
+			continue;
+
+		__lru_del(range);
+		range->purged = ASHMEM_WAS_PURGED;
+		list_add_tail(&range->lru, &batch);
+
+		scanned += range_size(range);
+		if (scanned >= nr_to_scan)
+			break;
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	list_for_each_entry_safe(range, next, &batch, lru) {
+		loff_t start = range->pgstart * PAGE_SIZE;
+		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+		list_del(&range->lru);
+		if (compress && !ashmem_compress_range(range))
+			continue;
+
+		vmtruncate_range(inode, start, end);
+		purged += range_size(range);
+	}
+
+	spin_lock(&ashmem_owner_lock);
+	asma->owner->purged_bytes += (u64)purged * PAGE_SIZE;
+	spin_unlock(&ashmem_owner_lock);
+
+	return scanned;
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -350,37 +816,58 @@ out:
  * Return value is the number of objects (pages) remaining, or -1 if we cannot
  * proceed without risk of deadlock (due to gfp_mask).
  *
- * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * We approximate LRU via least-recently-unpinned, jettisoning the unpinned
+ * partial chunks of the area owning the least-recently-unpinned chunk, one
+ * area at a time, until we hit 'nr_to_scan' pages freed. Areas with a cheaper
+ * purge priority all go before any area with a more expensive one.
+ *
+ * With CONFIG_ASHMEM_COMPRESS, ranges are compressed rather than purged while
+ * the compressed pool has room. Compressed ranges are purged in turn, oldest
+ * first, once there is nothing left to compress or the pool is full.
  */
-static int ashmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+static void __ashmem_shrink(int nr_to_scan, int compress)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_area *asma;
+	int prio, discard;
+
+	while (nr_to_scan > 0) {
+		/* areas being pinned or unpinned right now are skipped */
+		spin_lock(&ashmem_lru_lock);
+		asma = NULL;
+		if (ashmem_zpool_full())
+			asma = ashmem_zlru_trylock_area();
+		discard = asma != NULL;
+		for (prio = 0; prio < ASHMEM_PURGE_PRIORITY_NR && !asma; prio++)
+			asma = lru_trylock_area(&ashmem_lru_list[prio]);
+		/* deeper pressure: nothing left to compress */
+		if (!asma) {
+			asma = ashmem_zlru_trylock_area();
+			discard = 1;
+		}
+		spin_unlock(&ashmem_lru_lock);
 
+		if (!asma)
+			break;
+
+		if (discard)
+			nr_to_scan -= ashmem_discard_area(asma, nr_to_scan);
+		else
+			nr_to_scan -= ashmem_purge_area(asma, nr_to_scan,
+					compress && ashmem_should_compress());
+		mutex_unlock(&asma->mutex);
+	}
+}
+
+static int ashmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (nr_to_scan && !(gfp_mask & __GFP_FS))
 		return -1;
-	if (!nr_to_scan)
-		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+	if (nr_to_scan)
+		__ashmem_shrink(nr_to_scan, 1);
 
-		nr_to_scan -= range_size(range);
-		if (nr_to_scan <= 0)
-			break;
-	}
-	mutex_unlock(&ashmem_mutex);
-
-	return lru_count;
+	return lru_count + ashmem_zpool_pages();
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -392,7 +879,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -407,15 +894,38 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+static int set_purge_priority(struct ashmem_area *asma, unsigned long prio)
+{
+	struct ashmem_range *range;
+
+	if (unlikely(prio >= ASHMEM_PURGE_PRIORITY_NR))
+		return -EINVAL;
+
+	mutex_lock(&asma->mutex);
+
+	/* ranges already unpinned move over to the new LRU list */
+	spin_lock(&ashmem_lru_lock);
+	asma->purge_priority = prio;
+	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+		if (range_on_lru(range))
+			list_move_tail(&range->lru, &ashmem_lru_list[prio]);
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	mutex_unlock(&asma->mutex);
+
+	return 0;
+}
+
 static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -429,7 +939,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -438,7 +948,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -455,7 +965,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -464,7 +974,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -492,6 +1002,8 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    create a new range for the other side.
 		 */
 		if (page_range_in_range(range, pgstart, pgend)) {
+			if (range->purged == ASHMEM_COMPRESSED)
+				ashmem_restore_range(range);
 			ret |= range->purged;
 
 			/* Case #1: Easy. Just nuke the whole thing. */
@@ -530,7 +1042,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -550,6 +1062,8 @@ restart:
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
 		if (page_range_in_range(range, pgstart, pgend)) {
+			if (range->purged == ASHMEM_COMPRESSED)
+				ashmem_restore_range(range);
 			pgstart = min_t(size_t, range->pgstart, pgstart),
 			pgend = max_t(size_t, range->pgend, pgend);
 			purged |= range->purged;
@@ -565,7 +1079,7 @@ restart:
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
@@ -614,11 +1128,16 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
 		ret = ashmem_pin(asma, pgstart, pgend);
+		if (ret == ASHMEM_WAS_PURGED) {
+			spin_lock(&ashmem_owner_lock);
+			asma->owner->refaults++;
+			spin_unlock(&ashmem_owner_lock);
+		}
 		break;
 	case ASHMEM_UNPIN:
 		ret = ashmem_unpin(asma, pgstart, pgend);
@@ -628,7 +1147,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -766,7 +1285,7 @@ static int ashmem_flush_cache_range(struct ashmem_area *asma, unsigned int cmd)
 	unsigned long addr;
 	unsigned int size, result = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	size = asma->size;
 	addr = asma->vm_start;
@@ -788,7 +1307,7 @@ static int ashmem_flush_cache_range(struct ashmem_area *asma, unsigned int cmd)
 	}
 	mb();
 done:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return result;
 }
 
@@ -801,7 +1320,7 @@ static int ashmem_flush_cache_range(struct ashmem_area *asma)
 	unsigned long addr;
 	unsigned int size, result = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	size = asma->size;
 	addr = asma->vm_start;
@@ -832,7 +1351,7 @@ static int ashmem_flush_cache_range(struct ashmem_area *asma)
 	mb();
 #endif
 done:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return 0;
 }
 #endif // CONFIG_QCT_ASHMEM_CACHE_FLUSH
@@ -865,6 +1384,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_GET_PROT_MASK:
 		ret = asma->prot_mask;
 		break;
+	case ASHMEM_SET_PURGE_PRIORITY:
+		ret = set_purge_priority(asma, arg);
+		break;
+	case ASHMEM_GET_PURGE_PRIORITY:
+		ret = asma->purge_priority;
+		break;
 	case ASHMEM_PIN:
 	case ASHMEM_UNPIN:
 	case ASHMEM_GET_PIN_STATUS:
@@ -874,7 +1399,7 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
 			ret = ashmem_shrink(&ashmem_shrinker, 0, GFP_KERNEL);
-			ashmem_shrink(&ashmem_shrinker, ret, GFP_KERNEL);
+			__ashmem_shrink(ret, 0);
 		}
 		break;
 	case ASHMEM_CACHE_FLUSH_RANGE:
@@ -944,6 +1469,37 @@ void put_ashmem_file(struct file *file)
 }
 EXPORT_SYMBOL(put_ashmem_file);
 
+static int ashmem_purge_stats_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_owner *owner;
+
+	seq_printf(m, "%5s %-16s %5s %12s %8s\n",
+		   "pid", "comm", "areas", "purged_kb", "refaults");
+
+	spin_lock(&ashmem_owner_lock);
+	list_for_each_entry(owner, &ashmem_owner_list, list)
+		seq_printf(m, "%5d %-16s %5u %12llu %8llu\n",
+			   owner->tgid, owner->comm, owner->areas,
+			   owner->purged_bytes >> 10, owner->refaults);
+	spin_unlock(&ashmem_owner_lock);
+
+	return 0;
+}
+
+static int ashmem_purge_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_purge_stats_show, NULL);
+}
+
+static const struct file_operations ashmem_purge_stats_fops = {
+	.open = ashmem_purge_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *ashmem_debugfs_dir;
+
 static struct file_operations ashmem_fops = {
 	.owner = THIS_MODULE,
 	.open = ashmem_open,
@@ -981,6 +1537,12 @@ static int __init ashmem_init(void)
 		return -ENOMEM;
 	}
 
+	ret = ashmem_compress_init();
+	if (unlikely(ret)) {
+		printk(KERN_ERR "ashmem: failed to allocate compression buffers\n");
+		return ret;
+	}
+
 	ret = misc_register(&ashmem_misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "ashmem: failed to register misc device!\n");
@@ -989,6 +1551,11 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+	ashmem_debugfs_dir = debugfs_create_dir("ashmem", NULL);
+	if (ashmem_debugfs_dir)
+		debugfs_create_file("purge_stats", S_IRUGO, ashmem_debugfs_dir,
+				    NULL, &ashmem_purge_stats_fops);
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -1000,10 +1567,13 @@ static void __exit ashmem_exit(void)
 
 	unregister_shrinker(&ashmem_shrinker);
 
+	debugfs_remove_recursive(ashmem_debugfs_dir);
+
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
 		printk(KERN_ERR "ashmem: failed to unregister misc device!\n");
 
+	ashmem_compress_exit();
 	kmem_cache_destroy(ashmem_range_cachep);
 	kmem_cache_destroy(ashmem_area_cachep);
 
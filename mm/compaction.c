@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 /*
@@ -582,6 +584,178 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * kcompactd compacts a node in the background, ahead of the high-order
+ * allocations of drivers such as camera and display, so that these do not
+ * stall in direct compaction. It is woken when kswapd has balanced the node
+ * and when an allocation of compact_proactive_order or more enters the slow
+ * path, and compacts the zones whose fragmentation index for that order is
+ * above compact_proactive_threshold. An order of 0 disables it.
+ */
+int sysctl_compact_proactive_order = PAGE_ALLOC_COSTLY_ORDER + 1;
+int sysctl_compact_proactive_threshold = 500;
+
+static bool kcompactd_zone_suitable(struct zone *zone, int order)
+{
+	unsigned long watermark;
+
+	/* Order-0 watermarks must be met, as for direct compaction */
+	watermark = low_wmark_pages(zone) + (2UL << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return false;
+
+	/*
+	 * -1000 means a block of that order is free already, and 0 that
+	 * there are no free blocks at all; neither is above the threshold.
+	 */
+	return fragmentation_index(zone, order) >
+					sysctl_compact_proactive_threshold;
+}
+
+/*
+ * kcompactd keeps its own deferral state, so that its wakeups neither use
+ * up nor extend the backoff of direct compaction in the allocating tasks.
+ */
+static void kcompactd_defer(struct zone *zone)
+{
+	zone->kcompactd_considered = 0;
+	if (zone->kcompactd_defer_shift < COMPACT_MAX_DEFER_SHIFT)
+		zone->kcompactd_defer_shift++;
+}
+
+static bool kcompactd_deferred(struct zone *zone)
+{
+	unsigned long defer_limit = 1UL << zone->kcompactd_defer_shift;
+
+	if (zone->kcompactd_considered < defer_limit)
+		zone->kcompactd_considered++;
+
+	return zone->kcompactd_considered < defer_limit;
+}
+
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	int order = sysctl_compact_proactive_order;
+	int zoneid;
+
+	if (!order)
+		return;
+
+	count_vm_event(KCOMPACTD_WAKE);
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			/* what the driver buffers are allocated as */
+			.migratetype = MIGRATE_UNMOVABLE,
+			.zone = zone,
+		};
+
+		if (!populated_zone(zone))
+			continue;
+		if (kcompactd_deferred(zone))
+			continue;
+		if (!kcompactd_zone_suitable(zone, order))
+			continue;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+		compact_zone(zone, &cc);
+
+		/* Back off, as direct compaction does, if it did not help */
+		if (kcompactd_zone_suitable(zone, order))
+			kcompactd_defer(zone);
+		else {
+			zone->kcompactd_considered = 0;
+			zone->kcompactd_defer_shift = 0;
+		}
+
+		if (kthread_should_stop())
+			break;
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(pgdat->kcompactd_wait,
+				pgdat->kcompactd_wake || kthread_should_stop());
+		if (!pgdat->kcompactd_wake)
+			continue;
+		pgdat->kcompactd_wake = 0;
+		kcompactd_do_work(pgdat);
+	}
+	return 0;
+}
+
+/**
+ * wakeup_kcompactd - ask for background compaction of a node
+ * @pgdat: the node
+ * @order: order of the allocation asking, or 0 when kswapd has balanced
+ *	the node and goes to sleep
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order)
+{
+	if (!sysctl_compact_proactive_order)
+		return;
+	if (order && order < sysctl_compact_proactive_order)
+		return;
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	pgdat->kcompactd_wake = 1;
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
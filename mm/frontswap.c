@@ -0,0 +1,190 @@
+/*
+ * Frontswap frontend
+ *
+ * This code provides the generic "frontend" layer to call a matching
+ * "backend" driver implementation of frontswap: swap_writepage() offers
+ * each page to the backend before building a bio for it, and
+ * swap_readpage() asks the backend first. Pages the backend refuses go
+ * to the swap device as before.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/frontswap.h>
+
+/*
+ * Read on every swap-in and swap-out, so a global flag rather than a
+ * check of frontswap_ops (see cleancache_enabled).
+ */
+int frontswap_enabled;
+EXPORT_SYMBOL(frontswap_enabled);
+
+/*
+ * frontswap_ops is set by frontswap_register_ops to contain the pointers
+ * to the frontswap "backend" implementation functions.
+ */
+static struct frontswap_ops frontswap_ops;
+
+/* useful stats available in /sys/kernel/mm/frontswap */
+static unsigned long frontswap_succ_puts;
+static unsigned long frontswap_failed_puts;
+static unsigned long frontswap_gets;
+static unsigned long frontswap_flushes;
+
+/*
+ * Register operations for frontswap, returning the previous ones. Only
+ * swap areas enabled after this are handed to the backend.
+ */
+struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops)
+{
+	struct frontswap_ops old = frontswap_ops;
+
+	frontswap_ops = *ops;
+	frontswap_enabled = 1;
+	return old;
+}
+EXPORT_SYMBOL(frontswap_register_ops);
+
+/* Called by swapon, with swap_lock held */
+void __frontswap_init(struct swap_info_struct *sis, unsigned long *map)
+{
+	sis->frontswap_map = map;
+	atomic_set(&sis->frontswap_pages, 0);
+	(*frontswap_ops.init)(sis->type);
+}
+EXPORT_SYMBOL(__frontswap_init);
+
+/*
+ * Offer a page being swapped out to the backend, returning 0 if it took
+ * it. The page may have been put before, if it was dirtied again while
+ * in the swap cache: should the backend refuse the new data, the old
+ * copy is flushed so that it does not shadow what goes to the device.
+ * Page must be locked.
+ */
+int __frontswap_put_page(struct page *page)
+{
+	int ret, dup;
+	swp_entry_t entry = { .val = page_private(page), };
+	struct swap_info_struct *sis = page_swap_info(page);
+	pgoff_t offset = swp_offset(entry);
+
+	VM_BUG_ON(!PageLocked(page));
+	if (!sis->frontswap_map)
+		return -1;
+
+	dup = test_bit(offset, sis->frontswap_map);
+	ret = (*frontswap_ops.put_page)(sis->type, offset, page);
+	if (ret == 0) {
+		if (!dup) {
+			set_bit(offset, sis->frontswap_map);
+			atomic_inc(&sis->frontswap_pages);
+		}
+		frontswap_succ_puts++;
+	} else {
+		if (dup) {
+			clear_bit(offset, sis->frontswap_map);
+			atomic_dec(&sis->frontswap_pages);
+			(*frontswap_ops.flush_page)(sis->type, offset);
+		}
+		frontswap_failed_puts++;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_put_page);
+
+/*
+ * Fill the page from the backend if it holds it and return 0, else -1
+ * and the page is read from the swap device. Page must be locked.
+ */
+int __frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+	swp_entry_t entry = { .val = page_private(page), };
+	struct swap_info_struct *sis = page_swap_info(page);
+	pgoff_t offset = swp_offset(entry);
+
+	VM_BUG_ON(!PageLocked(page));
+	if (sis->frontswap_map && test_bit(offset, sis->frontswap_map)) {
+		ret = (*frontswap_ops.get_page)(sis->type, offset, page);
+		if (ret == 0)
+			frontswap_gets++;
+		else
+			printk(KERN_ALERT "frontswap: lost page (%d:%lu)\n",
+				sis->type, offset);
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_get_page);
+
+/* Called with swap_lock held when the swap slot is freed */
+void __frontswap_flush_page(struct swap_info_struct *sis, pgoff_t offset)
+{
+	if (sis->frontswap_map &&
+	    test_and_clear_bit(offset, sis->frontswap_map)) {
+		(*frontswap_ops.flush_page)(sis->type, offset);
+		atomic_dec(&sis->frontswap_pages);
+		frontswap_flushes++;
+	}
+}
+EXPORT_SYMBOL(__frontswap_flush_page);
+
+/* Called by swapoff with swap_lock held; the caller frees the map */
+unsigned long *__frontswap_flush_area(struct swap_info_struct *sis)
+{
+	unsigned long *map = sis->frontswap_map;
+
+	if (map) {
+		(*frontswap_ops.flush_area)(sis->type);
+		sis->frontswap_map = NULL;
+		atomic_set(&sis->frontswap_pages, 0);
+	}
+	return map;
+}
+EXPORT_SYMBOL(__frontswap_flush_area);
+
+#ifdef CONFIG_SYSFS
+
+#define FRONTSWAP_SYSFS_RO(_name) \
+	static ssize_t frontswap_##_name##_show(struct kobject *kobj, \
+				struct kobj_attribute *attr, char *buf) \
+	{ \
+		return sprintf(buf, "%lu\n", frontswap_##_name); \
+	} \
+	static struct kobj_attribute frontswap_##_name##_attr = { \
+		.attr = { .name = __stringify(_name), .mode = 0444 }, \
+		.show = frontswap_##_name##_show, \
+	}
+
+FRONTSWAP_SYSFS_RO(succ_puts);
+FRONTSWAP_SYSFS_RO(failed_puts);
+FRONTSWAP_SYSFS_RO(gets);
+FRONTSWAP_SYSFS_RO(flushes);
+
+static struct attribute *frontswap_attrs[] = {
+	&frontswap_succ_puts_attr.attr,
+	&frontswap_failed_puts_attr.attr,
+	&frontswap_gets_attr.attr,
+	&frontswap_flushes_attr.attr,
+	NULL,
+};
+
+static struct attribute_group frontswap_attr_group = {
+	.attrs = frontswap_attrs,
+	.name = "frontswap",
+};
+
+#endif /* CONFIG_SYSFS */
+
+static int __init init_frontswap(void)
+{
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &frontswap_attr_group))
+		printk(KERN_ERR "frontswap: unable to create sysfs group\n");
+#endif /* CONFIG_SYSFS */
+	return 0;
+}
+module_init(init_frontswap)
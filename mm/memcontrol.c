@@ -86,6 +86,8 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_PGPGIN_COUNT,	/* # of pages paged in */
 	MEM_CGROUP_STAT_PGPGOUT_COUNT,	/* # of pages paged out */
 	MEM_CGROUP_STAT_SWAPOUT, /* # of pages, swapped out */
+	MEM_CGROUP_STAT_WORKINGSET_REFAULT,	/* # of file pages refaulted */
+	MEM_CGROUP_STAT_WORKINGSET_ACTIVATE,	/* # of those in working set */
 	MEM_CGROUP_EVENTS,	/* incremented at every  pagein/pageout */
 
 	MEM_CGROUP_STAT_NSTATS,
@@ -176,6 +178,13 @@ struct mem_cgroup_eventfd_list {
 	struct eventfd_ctx *eventfd;
 };
 
+/* for memory.pressure_level */
+struct mem_cgroup_pressure_event {
+	struct list_head list;
+	struct eventfd_ctx *eventfd;
+	unsigned int level;
+};
+
 static void mem_cgroup_threshold(struct mem_cgroup *mem);
 static void mem_cgroup_oom_notify(struct mem_cgroup *mem);
 
@@ -244,6 +253,16 @@ struct mem_cgroup {
 	/* For oom notifier event fd */
 	struct list_head oom_notify;
 
+	/*
+	 * Reclaim efficiency of this cgroup, see mem_cgroup_vmpressure().
+	 * pressure_lock protects the window and pressure_notify.
+	 */
+	spinlock_t pressure_lock;
+	unsigned long pressure_scanned;
+	unsigned long pressure_reclaimed;
+	unsigned int pressure;		/* of the last full window, 0-100 */
+	struct list_head pressure_notify;
+
 	/*
 	 * Should we move charges of a task when a task is moved into this
 	 * mem_cgroup ? And what type of charges should we move ?
@@ -1014,7 +1033,7 @@ unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 		if (scan >= nr_to_scan)
 			break;
 
-		page = pc->page;
+		page = lookup_cgroup_page(pc);
 		if (unlikely(!PageCgroupUsed(pc)))
 			continue;
 		if (unlikely(!PageLRU(page)))
@@ -1455,6 +1474,33 @@ done:
 	unlock_page_cgroup(pc);
 }
 
+/*
+ * Account a refault of an evicted file page, see mm/workingset.c.
+ */
+void mem_cgroup_workingset_refault(struct page *page, bool activate)
+{
+	struct mem_cgroup *mem;
+	struct page_cgroup *pc;
+
+	if (mem_cgroup_disabled())
+		return;
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc))
+		return;
+
+	lock_page_cgroup(pc);
+	mem = pc->mem_cgroup;
+	if (mem && PageCgroupUsed(pc)) {
+		/* Preemption is disabled by lock_page_cgroup() */
+		__this_cpu_inc(mem->stat->count[
+				MEM_CGROUP_STAT_WORKINGSET_REFAULT]);
+		if (activate)
+			__this_cpu_inc(mem->stat->count[
+				MEM_CGROUP_STAT_WORKINGSET_ACTIVATE]);
+	}
+	unlock_page_cgroup(pc);
+}
+
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
  * TODO: maybe necessary to use big numbers in big irons.
@@ -1857,7 +1903,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 	 * Insert ancestor (and ancestor's ancestors), to softlimit RB-tree.
 	 * if they exceeds softlimit.
 	 */
-	memcg_check_events(mem, pc->page);
+	memcg_check_events(mem, lookup_cgroup_page(pc));
 }
 
 /**
@@ -1881,7 +1927,7 @@ static void __mem_cgroup_move_account(struct page_cgroup *pc,
 	struct mem_cgroup *from, struct mem_cgroup *to, bool uncharge)
 {
 	VM_BUG_ON(from == to);
-	VM_BUG_ON(PageLRU(pc->page));
+	VM_BUG_ON(PageLRU(lookup_cgroup_page(pc)));
 	VM_BUG_ON(!PageCgroupLocked(pc));
 	VM_BUG_ON(!PageCgroupUsed(pc));
 	VM_BUG_ON(pc->mem_cgroup != from);
@@ -1917,7 +1963,9 @@ static void __mem_cgroup_move_account(struct page_cgroup *pc,
 static int mem_cgroup_move_account(struct page_cgroup *pc,
 		struct mem_cgroup *from, struct mem_cgroup *to, bool uncharge)
 {
+	struct page *page = lookup_cgroup_page(pc);
 	int ret = -EINVAL;
+
 	lock_page_cgroup(pc);
 	if (PageCgroupUsed(pc) && pc->mem_cgroup == from) {
 		__mem_cgroup_move_account(pc, from, to, uncharge);
@@ -1927,8 +1975,8 @@ static int mem_cgroup_move_account(struct page_cgroup *pc,
 	/*
 	 * check events
 	 */
-	memcg_check_events(to, pc->page);
-	memcg_check_events(from, pc->page);
+	memcg_check_events(to, page);
+	memcg_check_events(from, page);
 	return ret;
 }
 
@@ -1940,7 +1988,7 @@ static int mem_cgroup_move_parent(struct page_cgroup *pc,
 				  struct mem_cgroup *child,
 				  gfp_t gfp_mask)
 {
-	struct page *page = pc->page;
+	struct page *page = lookup_cgroup_page(pc);
 	struct cgroup *cg = child->css.cgroup;
 	struct cgroup *pcg = cg->parent;
 	struct mem_cgroup *parent;
@@ -2037,6 +2085,11 @@ int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 		return 0;
 	if (PageCompound(page))
 		return 0;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_LAZY_CACHE
+	/* charged when it gets mapped, see mem_cgroup_charge_mapped() */
+	if (page_is_file_cache(page))
+		return 0;
+#endif
 	/*
 	 * Corner case handling. This is called from add_to_page_cache()
 	 * in usual. But some FS (shmem) precharges this page before calling it
@@ -2083,6 +2136,39 @@ int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 	return ret;
 }
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_LAZY_CACHE
+/**
+ * mem_cgroup_charge_mapped - charge page cache on its first mapping
+ * @page: the locked page cache page being mapped
+ * @mm: the mm it is mapped into
+ *
+ * Page cache is not charged when it is read in but to the memcg of the
+ * first task mapping it, by which time the page may be on the LRU. A
+ * failed charge leaves the page to global reclaim rather than failing
+ * the fault.
+ */
+void mem_cgroup_charge_mapped(struct page *page, struct mm_struct *mm)
+{
+	struct mem_cgroup *mem = NULL;
+	struct page_cgroup *pc;
+
+	if (mem_cgroup_disabled())
+		return;
+	VM_BUG_ON(!PageLocked(page));
+	/* truncated meanwhile, or shmem which is charged at insertion */
+	if (!page->mapping || PageCompound(page) || !page_is_file_cache(page))
+		return;
+	pc = lookup_page_cgroup(page);
+	/* an unlocked test, commit checks again under lock_page_cgroup() */
+	if (!pc || PageCgroupUsed(pc))
+		return;
+	if (__mem_cgroup_try_charge(mm, GFP_KERNEL, &mem, false))
+		return;
+	__mem_cgroup_commit_charge_swapin(page, mem,
+					  MEM_CGROUP_CHARGE_TYPE_CACHE);
+}
+#endif
+
 /*
  * While swap-in, try_charge -> commit or cancel, the page is locked.
  * And when try_charge() successfully returns, one refcnt to memcg without
@@ -3291,6 +3377,8 @@ enum {
 	MCS_INACTIVE_FILE,
 	MCS_ACTIVE_FILE,
 	MCS_UNEVICTABLE,
+	MCS_WORKINGSET_REFAULT,
+	MCS_WORKINGSET_ACTIVATE,
 	NR_MCS_STAT,
 };
 
@@ -3312,7 +3400,9 @@ struct {
 	{"active_anon", "total_active_anon"},
 	{"inactive_file", "total_inactive_file"},
 	{"active_file", "total_active_file"},
-	{"unevictable", "total_unevictable"}
+	{"unevictable", "total_unevictable"},
+	{"workingset_refault", "total_workingset_refault"},
+	{"workingset_activate", "total_workingset_activate"}
 };
 
 
@@ -3348,6 +3438,11 @@ static int mem_cgroup_get_local_stat(struct mem_cgroup *mem, void *data)
 	s->stat[MCS_ACTIVE_FILE] += val * PAGE_SIZE;
 	val = mem_cgroup_get_local_zonestat(mem, LRU_UNEVICTABLE);
 	s->stat[MCS_UNEVICTABLE] += val * PAGE_SIZE;
+
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_WORKINGSET_REFAULT);
+	s->stat[MCS_WORKINGSET_REFAULT] += val;
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_WORKINGSET_ACTIVATE);
+	s->stat[MCS_WORKINGSET_ACTIVATE] += val;
 	return 0;
 }
 
@@ -3787,6 +3882,90 @@ static int mem_cgroup_oom_control_write(struct cgroup *cgrp,
 	return 0;
 }
 
+/* pages scanned per pressure sample, smaller than the global one */
+#define MEM_CGROUP_PRESSURE_WIN	(SWAP_CLUSTER_MAX * 4)
+
+/**
+ * mem_cgroup_vmpressure - account the outcome of reclaim from a memcg
+ * @mem: the memcg reclaimed from, over its limit or soft limit
+ * @gfp_mask: gfp mask of the allocation that caused reclaim
+ * @scanned: pages scanned
+ * @reclaimed: pages reclaimed out of @scanned
+ *
+ * The per-memcg counterpart of vmpressure(): every full window of scanned
+ * pages gives a pressure value from 0 to 100, which wakes up the listeners
+ * of memory.pressure_level registered for that level or a lower one.
+ */
+void mem_cgroup_vmpressure(struct mem_cgroup *mem, gfp_t gfp_mask,
+			   unsigned long scanned, unsigned long reclaimed)
+{
+	struct mem_cgroup_pressure_event *ev;
+	unsigned int pressure;
+
+	if (!(gfp_mask & (__GFP_IO | __GFP_FS)) || !scanned)
+		return;
+
+	spin_lock(&mem->pressure_lock);
+	mem->pressure_scanned += scanned;
+	mem->pressure_reclaimed += reclaimed;
+	scanned = mem->pressure_scanned;
+	reclaimed = min(mem->pressure_reclaimed, scanned);
+	if (scanned >= MEM_CGROUP_PRESSURE_WIN) {
+		mem->pressure_scanned = mem->pressure_reclaimed = 0;
+		pressure = 100 - reclaimed * 100 / scanned;
+		mem->pressure = pressure;
+		list_for_each_entry(ev, &mem->pressure_notify, list)
+			if (pressure >= ev->level)
+				eventfd_signal(ev->eventfd, 1);
+	}
+	spin_unlock(&mem->pressure_lock);
+}
+
+static u64 mem_cgroup_pressure_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return mem_cgroup_from_cont(cgrp)->pressure;
+}
+
+static int mem_cgroup_pressure_register_event(struct cgroup *cgrp,
+	struct cftype *cft, struct eventfd_ctx *eventfd, const char *args)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cgrp);
+	struct mem_cgroup_pressure_event *event;
+	unsigned long level;
+
+	if (strict_strtoul(args, 10, &level) || level > 100)
+		return -EINVAL;
+
+	event = kmalloc(sizeof(*event), GFP_KERNEL);
+	if (!event)
+		return -ENOMEM;
+	event->eventfd = eventfd;
+	event->level = level;
+
+	spin_lock(&mem->pressure_lock);
+	list_add(&event->list, &mem->pressure_notify);
+	spin_unlock(&mem->pressure_lock);
+	return 0;
+}
+
+static void mem_cgroup_pressure_unregister_event(struct cgroup *cgrp,
+	struct cftype *cft, struct eventfd_ctx *eventfd)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cgrp);
+	struct mem_cgroup_pressure_event *ev, *tmp;
+	LIST_HEAD(dead);
+
+	spin_lock(&mem->pressure_lock);
+	list_for_each_entry_safe(ev, tmp, &mem->pressure_notify, list) {
+		if (ev->eventfd == eventfd)
+			list_move(&ev->list, &dead);
+	}
+	spin_unlock(&mem->pressure_lock);
+
+	list_for_each_entry_safe(ev, tmp, &dead, list)
+		kfree(ev);
+}
+
 static struct cftype mem_cgroup_files[] = {
 	{
 		.name = "usage_in_bytes",
@@ -3850,6 +4029,12 @@ static struct cftype mem_cgroup_files[] = {
 		.unregister_event = mem_cgroup_oom_unregister_event,
 		.private = MEMFILE_PRIVATE(_OOM_TYPE, OOM_CONTROL),
 	},
+	{
+		.name = "pressure_level",
+		.read_u64 = mem_cgroup_pressure_read,
+		.register_event = mem_cgroup_pressure_register_event,
+		.unregister_event = mem_cgroup_pressure_unregister_event,
+	},
 };
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
@@ -4107,6 +4292,8 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	mem->last_scanned_child = 0;
 	spin_lock_init(&mem->reclaim_param_lock);
 	INIT_LIST_HEAD(&mem->oom_notify);
+	spin_lock_init(&mem->pressure_lock);
+	INIT_LIST_HEAD(&mem->pressure_notify);
 
 	if (parent)
 		mem->swappiness = get_swappiness(parent);
@@ -3071,6 +3071,10 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	}
 
+	/* lazily charged page cache is charged on its first mapping */
+	if (!anon)
+		mem_cgroup_charge_mapped(page, mm);
+
 	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
 
 	/*
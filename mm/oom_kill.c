@@ -35,6 +35,73 @@ int sysctl_oom_dump_tasks = 1;
 static DEFINE_SPINLOCK(zone_scan_lock);
 /* #define DEBUG */
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+DEFINE_SPINLOCK(oom_adj_lock);
+struct hlist_head oom_adj_buckets[OOM_ADJ_BUCKETS];
+
+/*
+ * oom_adj_add_task - hash a new thread group leader by its oom_adj
+ *
+ * The oom_adj_* hooks follow the task's place on the task list and are called
+ * with tasklist_lock write-locked, interrupts off. oom_adj_lock is also taken
+ * by the low memory killer and the oom_adj writers, and an interrupt may
+ * read_lock tasklist_lock (send_sigio), so it is always taken irqsave.
+ */
+void oom_adj_add_task(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_lock, flags);
+	hlist_add_head(&p->oom_adj_node, oom_adj_bucket(p->signal->oom_adj));
+	spin_unlock_irqrestore(&oom_adj_lock, flags);
+}
+
+void oom_adj_del_task(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_lock, flags);
+	hlist_del_init(&p->oom_adj_node);
+	spin_unlock_irqrestore(&oom_adj_lock, flags);
+}
+
+/* a non-leader thread took over the thread group in exec */
+void oom_adj_replace_task(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&oom_adj_lock, flags);
+	if (!hlist_unhashed(&old->oom_adj_node)) {
+		hlist_add_before(&new->oom_adj_node, &old->oom_adj_node);
+		hlist_del_init(&old->oom_adj_node);
+	}
+	spin_unlock_irqrestore(&oom_adj_lock, flags);
+}
+
+/*
+ * oom_adj_update_task - rehash the process of 'p' after its oom_adj changed
+ *
+ * Reads oom_adj again under the lock, so concurrent updates end up on the
+ * list of whichever value was written last.
+ */
+void oom_adj_update_task(struct task_struct *p)
+{
+	struct task_struct *leader;
+	unsigned long flags;
+
+	read_lock(&tasklist_lock);
+	leader = p->group_leader;
+	spin_lock_irqsave(&oom_adj_lock, flags);
+	if (!hlist_unhashed(&leader->oom_adj_node)) {
+		hlist_del(&leader->oom_adj_node);
+		hlist_add_head(&leader->oom_adj_node,
+			       oom_adj_bucket(leader->signal->oom_adj));
+	}
+	spin_unlock_irqrestore(&oom_adj_lock, flags);
+	read_unlock(&tasklist_lock);
+}
+#endif
+
 /*
  * Is all threads of the target process nodes overlap ours?
  */
@@ -424,6 +424,19 @@ int page_mapped_in_vma(struct page *page, struct vm_area_struct *vma)
 	return 1;
 }
 
+/*
+ * How much a reference from 'mm' counts: double from the foreground, not
+ * at all from the background, see vm_reclaim_protect_adj.
+ */
+static inline int reference_weight(struct mm_struct *mm)
+{
+	if (mm->oom_adj <= vm_reclaim_protect_adj)
+		return 2;
+	if (mm->oom_adj >= vm_reclaim_background_adj)
+		return 0;
+	return 1;
+}
+
 /*
  * Subfunctions of page_referenced: page_referenced_one called
  * repeatedly from either page_referenced_anon or page_referenced_file.
@@ -461,7 +474,7 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		 * set PG_referenced or activated the page.
 		 */
 		if (likely(!VM_SequentialReadHint(vma)))
-			referenced++;
+			referenced += reference_weight(mm);
 	}
 
 	/* Pretend the page is referenced if the task has the
@@ -0,0 +1,80 @@
+/*
+ * linux/mm/vmpressure.c
+ *
+ * Memory pressure as the ratio of pages reclaimed to pages scanned.
+ *
+ * Reclaim scans pages faster than it frees them when what is left on the
+ * LRU lists is hard to reclaim, so a falling ratio means that allocations
+ * are about to stall. Global reclaim adds what it scanned and reclaimed to
+ * a window; every VMPRESSURE_WIN scanned pages the window is turned into a
+ * pressure value and handed to the notifier chain.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/module.h>
+#include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/vmpressure.h>
+
+/* pages scanned per pressure sample */
+#define VMPRESSURE_WIN		(SWAP_CLUSTER_MAX * 16)
+
+static ATOMIC_NOTIFIER_HEAD(vmpressure_notifier);
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+
+int vmpressure_register_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL(vmpressure_register_notifier);
+
+int vmpressure_unregister_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL(vmpressure_unregister_notifier);
+
+/**
+ * vmpressure() - account the outcome of a reclaim pass
+ * @gfp_mask:	gfp mask of the allocation that caused reclaim
+ * @scanned:	pages scanned
+ * @reclaimed:	pages reclaimed out of @scanned
+ *
+ * Called by global reclaim after shrinking a zone; may be called from
+ * atomic context.
+ */
+void vmpressure(gfp_t gfp_mask, unsigned long scanned, unsigned long reclaimed)
+{
+	unsigned long pressure;
+
+	/*
+	 * Reclaim that may not do IO or touch the filesystem cannot reclaim
+	 * much of anything, which says little about the system.
+	 */
+	if (!(gfp_mask & (__GFP_IO | __GFP_FS)))
+		return;
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	scanned = vmpressure_scanned;
+	reclaimed = vmpressure_reclaimed;
+	if (scanned < VMPRESSURE_WIN) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	vmpressure_scanned = vmpressure_reclaimed = 0;
+	spin_unlock(&vmpressure_lock);
+
+	/* reclaim can free more than it scanned, e.g. whole swap clusters */
+	reclaimed = min(reclaimed, scanned);
+	pressure = 100 - reclaimed * 100 / scanned;
+
+	atomic_notifier_call_chain(&vmpressure_notifier, pressure, NULL);
+}
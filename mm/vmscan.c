@@ -40,6 +40,8 @@
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
 #include <linux/sysctl.h>
+#include <linux/vmpressure.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -125,6 +127,17 @@ struct scan_control {
  * From 0 .. 100.  Higher means more swappy.
  */
 int vm_swappiness = 90;
+
+/*
+ * Page references from processes with an oom_adj at or below
+ * vm_reclaim_protect_adj (the foreground app and system processes) count
+ * twice, which is enough to activate the page. References that come only
+ * from processes at or above vm_reclaim_background_adj (cached apps, which
+ * the low memory killer takes first anyway) do not count at all.
+ */
+int vm_reclaim_protect_adj;
+int vm_reclaim_background_adj = 7;
+
 long vm_total_pages;	/* The total number of pages which the VM controls */
 
 static LIST_HEAD(shrinker_list);
@@ -454,6 +467,7 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		spin_unlock_irq(&mapping->tree_lock);
 		swapcache_free(swap, page);
 	} else {
+		workingset_eviction(mapping, page);
 		__remove_from_page_cache(page);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
@@ -604,7 +618,11 @@ static enum page_references page_check_references(struct page *page,
 		 */
 		SetPageReferenced(page);
 
-		if (referenced_page)
+		/*
+		 * More than one reference means more than one user, or
+		 * the foreground app (see page_referenced_one()).
+		 */
+		if (referenced_page || referenced_ptes > 1)
 			return PAGEREF_ACTIVATE;
 
 		return PAGEREF_KEEP;
@@ -826,6 +844,8 @@ activate_locked:
 		VM_BUG_ON(PageActive(page));
 		SetPageActive(page);
 		pgactivate++;
+		if (page_is_file_cache(page))
+			workingset_activation(page);
 keep_locked:
 		unlock_page(page);
 keep:
@@ -1704,6 +1724,7 @@ static void shrink_zone(int priority, struct zone *zone,
 	enum lru_list l;
 	unsigned long nr_reclaimed = sc->nr_reclaimed;
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_scanned = sc->nr_scanned;
 
 	get_scan_count(zone, sc, nr, priority);
 
@@ -1733,6 +1754,13 @@ static void shrink_zone(int priority, struct zone *zone,
 			break;
 	}
 
+	if (scanning_global_lru(sc))
+		vmpressure(sc->gfp_mask, sc->nr_scanned - nr_scanned,
+			   nr_reclaimed - sc->nr_reclaimed);
+	else
+		mem_cgroup_vmpressure(sc->mem_cgroup, sc->gfp_mask,
+				      sc->nr_scanned - nr_scanned,
+				      nr_reclaimed - sc->nr_reclaimed);
 	sc->nr_reclaimed = nr_reclaimed;
 
 	/*
@@ -2363,6 +2391,8 @@ static int kswapd(void *p)
 				 */
 				if (!sleeping_prematurely(pgdat, order, remaining)) {
 					restore_pgdat_percpu_threshold(pgdat);
+					/* a balanced node is worth compacting */
+					wakeup_kcompactd(pgdat, 0);
 					schedule();
 					reduce_pgdat_percpu_threshold(pgdat);
 				} else {
@@ -2406,6 +2436,8 @@ void wakeup_kswapd(struct zone *zone, int order)
 	pgdat = zone->zone_pgdat;
 	if (pgdat->kswapd_max_order < order)
 		pgdat->kswapd_max_order = order;
+	if (order)
+		wakeup_kcompactd(pgdat, order);
 	if (!waitqueue_active(&pgdat->kswapd_wait))
 		return;
 	if (zone_watermark_ok_safe(zone, order, low_wmark_pages(zone), 0, 0))
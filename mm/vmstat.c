@@ -812,6 +812,8 @@ static const char * const vmstat_text[] = {
 	"nr_isolated_anon",
 	"nr_isolated_file",
 	"nr_shmem",
+	"workingset_refault",
+	"workingset_activate",
 #ifdef CONFIG_NUMA
 	"numa_hit",
 	"numa_miss",
@@ -832,6 +834,10 @@ static const char * const vmstat_text[] = {
 	"pgfree",
 	"pgactivate",
 	"pgdeactivate",
+	"pcp_hit",
+	"pcp_refill",
+	"pcp_high_hit",
+	"pcp_high_refill",
 
 	"pgfault",
 	"pgmajfault",
@@ -856,6 +862,9 @@ static const char * const vmstat_text[] = {
 
 	"pgrotated",
 
+	"highorder_slowpath",
+	"highorder_slowpath_us",
+
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
 	"compact_pages_moved",
@@ -863,6 +872,7 @@ static const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_daemon_wake",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
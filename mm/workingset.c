@@ -0,0 +1,206 @@
+/*
+ *  linux/mm/workingset.c
+ *
+ *  Workingset detection
+ *
+ * Reclaim cannot tell by itself whether it is evicting pages which are
+ * faulted right back in. To find out, the eviction of every page cache
+ * page is recorded, stamped with its zone's inactive age: a clock which
+ * advances with every eviction from, and every activation out of, the
+ * inactive file list. When the page is read back in, the distance between
+ * the two stamps is the number of extra inactive slots it would have taken
+ * for the page to stay resident. If that is no more than the size of the
+ * active file list, the page would have stayed had it competed with the
+ * active pages, so it is part of the working set: it goes straight to the
+ * active list instead of having to prove itself on the inactive list
+ * again, and it is counted as a workingset activation.
+ *
+ * The page cache radix tree of this kernel cannot hold anything but pages,
+ * so the eviction records live in a separate hash table keyed by mapping
+ * and index, each bucket overwriting its oldest record. The table holds
+ * as many records as half the pages of RAM, more than the active file
+ * list, which bounds the refault distance of a working set page, ever
+ * gets to. A mapping freed and reused may rarely be credited with a
+ * refault of its predecessor.
+ *
+ * Refaults show up in /proc/vmstat, in memory.stat and, per task, in
+ * /proc/<pid>/status.
+ */
+
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/memcontrol.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmalloc.h>
+#include <linux/vmstat.h>
+#include <linux/init.h>
+
+#define WORKINGSET_BUCKET_SIZE	7
+
+/*
+ * An eviction record packs the zone and the low bits of its inactive age,
+ * which is plenty since only distances up to the active list size matter.
+ */
+#define EVICTION_ZONE_SHIFT	(NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK		(~0U >> EVICTION_ZONE_SHIFT)
+
+struct workingset_bucket {
+	spinlock_t lock;
+	unsigned int hand;		/* next record to overwrite */
+	u32 key[WORKINGSET_BUCKET_SIZE];
+	u32 eviction[WORKINGSET_BUCKET_SIZE];
+};
+
+static struct workingset_bucket *workingset_table;
+static unsigned int workingset_hash_shift;
+
+static u32 workingset_key(struct address_space *mapping, pgoff_t index)
+{
+	/* 0 marks an empty record */
+	return jhash_2words((u32)(unsigned long)mapping, (u32)index, 0) | 1;
+}
+
+static struct workingset_bucket *workingset_bucket(u32 key)
+{
+	return &workingset_table[hash_32(key, workingset_hash_shift)];
+}
+
+static u32 pack_eviction(struct zone *zone, unsigned long age)
+{
+	u32 zoneid = (zone_to_nid(zone) << ZONES_SHIFT) | zone_idx(zone);
+
+	return (age & EVICTION_MASK) << EVICTION_ZONE_SHIFT | zoneid;
+}
+
+static struct zone *unpack_eviction(u32 eviction, unsigned long *age)
+{
+	u32 zoneid = eviction & ((1U << EVICTION_ZONE_SHIFT) - 1);
+
+	*age = eviction >> EVICTION_ZONE_SHIFT;
+	return &NODE_DATA(zoneid >> ZONES_SHIFT)->node_zones[zoneid &
+					((1U << ZONES_SHIFT) - 1)];
+}
+
+/**
+ * workingset_eviction - note the eviction of a page cache page
+ * @mapping: the mapping the page is being removed from
+ * @page: the page, still locked and in @mapping
+ *
+ * Called by reclaim with the mapping's tree_lock held.
+ */
+void workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	struct workingset_bucket *b;
+	unsigned long age;
+	u32 key;
+
+	age = atomic_long_inc_return(&zone->inactive_age);
+	if (!workingset_table)
+		return;
+
+	key = workingset_key(mapping, page->index);
+	b = workingset_bucket(key);
+
+	spin_lock(&b->lock);
+	b->key[b->hand] = key;
+	b->eviction[b->hand] = pack_eviction(zone, age);
+	if (++b->hand == WORKINGSET_BUCKET_SIZE)
+		b->hand = 0;
+	spin_unlock(&b->lock);
+}
+
+/**
+ * workingset_refault - check a page cache page being read in for refault
+ * @page: the page, just added to the page cache but not yet to the LRU
+ *
+ * Returns true if the page was evicted recently enough to be part of the
+ * working set, in which case it should go to the active list.
+ */
+bool workingset_refault(struct page *page)
+{
+	struct workingset_bucket *b;
+	unsigned long flags, age, refault, distance;
+	struct zone *zone;
+	u32 key, eviction = 0;
+	bool activate;
+	int i;
+
+	if (!workingset_table)
+		return false;
+
+	key = workingset_key(page->mapping, page->index);
+	b = workingset_bucket(key);
+
+	spin_lock_irqsave(&b->lock, flags);
+	for (i = 0; i < WORKINGSET_BUCKET_SIZE; i++) {
+		if (b->key[i] == key) {
+			b->key[i] = 0;
+			eviction = b->eviction[i];
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&b->lock, flags);
+
+	if (i == WORKINGSET_BUCKET_SIZE)
+		return false;
+
+	zone = unpack_eviction(eviction, &age);
+	refault = atomic_long_read(&zone->inactive_age);
+	distance = (refault - age) & EVICTION_MASK;
+	activate = distance <= zone_page_state(zone, NR_ACTIVE_FILE);
+
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+	current->refaults++;
+	if (activate) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		current->refaults_active++;
+		/* the activation ages the inactive list as well */
+		atomic_long_inc(&page_zone(page)->inactive_age);
+	}
+	mem_cgroup_workingset_refault(page, activate);
+
+	return activate;
+}
+
+/**
+ * workingset_activation - note a page moving to the active file list
+ * @page: the page
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+static int __init workingset_init(void)
+{
+	struct workingset_bucket *table;
+	unsigned long buckets, i;
+
+	buckets = totalram_pages / 2 / WORKINGSET_BUCKET_SIZE;
+	buckets = rounddown_pow_of_two(max(buckets, 1UL));
+
+	table = vmalloc(buckets * sizeof(*table));
+	if (!table) {
+		printk(KERN_WARNING "workingset: no memory for the eviction "
+				"table, refaults are not tracked\n");
+		return 0;
+	}
+
+	for (i = 0; i < buckets; i++) {
+		spin_lock_init(&table[i].lock);
+		table[i].hand = 0;
+		memset(table[i].key, 0, sizeof(table[i].key));
+	}
+
+	workingset_hash_shift = ilog2(buckets);
+	smp_wmb();
+	workingset_table = table;
+	return 0;
+}
+module_init(workingset_init)